@@ -0,0 +1,315 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Load generator for run_server. Opens several connections, each on its own thread, and
+// keeps a fixed number of requests in flight on each one. Reports the request rate and the
+// p50/p99 latency across all of them.
+//
+// With --control, it instead sends one trace control request (trace-start, trace-stop or
+// relayout), so a trace can be recorded under load and the server's trie relaid out from it.
+
+// Out of every 100 requests, how many are searches and suggestions. The rest are inserts.
+const int SEARCH_PERCENT = 80;
+const int SUGGEST_PERCENT = 15;
+
+// Length of the prefixes sent with suggestion requests
+const size_t SUGGEST_PREFIX_LENGTH = 3;
+
+struct connection_result {
+    vector<double> latencies_us;
+    int errors;
+};
+
+int Connect(const string& socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    return fd;
+}
+
+bool WriteAll(int fd, const string& buffer) {
+    size_t offset = 0;
+
+    while (offset < buffer.length()) {
+        ssize_t written = write(fd, buffer.data() + offset, buffer.length() - offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        offset += written;
+    }
+
+    return true;
+}
+
+void RunConnection(const string& socket_path, const vector<string>& words, int request_count, int pipeline_depth, int seed, connection_result& result) {
+    result.errors = 0;
+
+    int fd = Connect(socket_path);
+
+    if (fd < 0) {
+        result.errors = request_count;
+        return;
+    }
+
+    mt19937 random(seed);
+    uniform_int_distribution<size_t> pick_word(0, words.size() - 1);
+    uniform_int_distribution<int> pick_op(0, 99);
+
+    // When each request still waiting for a response was sent
+    map<uint32_t, steady_clock::time_point> in_flight;
+    uint32_t next_id = 0;
+    int received_count = 0;
+    string in_buffer;
+    char chunk[65536];
+
+    while (received_count < request_count) {
+        // Top up the pipeline
+        string out_buffer;
+
+        while (next_id < (uint32_t)request_count && in_flight.size() < (size_t)pipeline_depth) {
+            request req;
+            req.id = next_id++;
+            req.key = words.at(pick_word(random));
+
+            int roll = pick_op(random);
+
+            if (roll < SEARCH_PERCENT) {
+                req.op = OP_SEARCH;
+            }
+            else if (roll < SEARCH_PERCENT + SUGGEST_PERCENT) {
+                req.op = OP_SUGGEST;
+                req.key = req.key.substr(0, SUGGEST_PREFIX_LENGTH);
+            }
+            else {
+                req.op = OP_INSERT;
+            }
+
+            EncodeRequest(out_buffer, req);
+            in_flight[req.id] = steady_clock::now();
+        }
+
+        if (!WriteAll(fd, out_buffer)) {
+            break;
+        }
+
+        // Wait for at least one response
+        ssize_t received = read(fd, chunk, sizeof(chunk));
+
+        if (received <= 0) {
+            break;
+        }
+
+        in_buffer.append(chunk, received);
+
+        size_t offset = 0;
+        response res;
+
+        while (size_t used = DecodeResponse(in_buffer, offset, res)) {
+            offset += used;
+
+            auto sent = in_flight.find(res.id);
+
+            if (sent == in_flight.end()) {
+                continue;
+            }
+
+            result.latencies_us.push_back(duration<double, micro>(steady_clock::now() - sent->second).count());
+            in_flight.erase(sent);
+            received_count++;
+
+            if (res.status == STATUS_BAD_REQUEST) {
+                result.errors++;
+            }
+        }
+
+        in_buffer.erase(0, offset);
+    }
+
+    // Anything still waiting when the connection broke counts as an error
+    result.errors += request_count - received_count;
+
+    close(fd);
+}
+
+double Percentile(const vector<double>& sorted_values, double percent) {
+    if (sorted_values.empty()) {
+        return 0;
+    }
+
+    size_t index = (size_t)(percent / 100.0 * (sorted_values.size() - 1));
+
+    return sorted_values.at(index);
+}
+
+// Sends a single trace control request to the server and prints the result
+int RunControl(const string& command, const string& socket_path) {
+    request req;
+    req.id = 0;
+
+    if (command == "trace-start") {
+        req.op = OP_TRACE_START;
+    }
+    else if (command == "trace-stop") {
+        req.op = OP_TRACE_STOP;
+    }
+    else if (command == "relayout") {
+        req.op = OP_RELAYOUT;
+    }
+    else {
+        cout << "Unknown control command '" << command << "'. Use trace-start, trace-stop or relayout." << endl;
+        return 1;
+    }
+
+    int fd = Connect(socket_path);
+
+    if (fd < 0) {
+        cout << "Couldn't connect to " << socket_path << endl;
+        return 1;
+    }
+
+    string out_buffer;
+    EncodeRequest(out_buffer, req);
+
+    string in_buffer;
+    char chunk[4096];
+    response res;
+    bool answered = false;
+
+    if (WriteAll(fd, out_buffer)) {
+        while (!answered) {
+            ssize_t received = read(fd, chunk, sizeof(chunk));
+
+            if (received <= 0) {
+                break;
+            }
+
+            in_buffer.append(chunk, received);
+            answered = DecodeResponse(in_buffer, 0, res) > 0;
+        }
+    }
+
+    close(fd);
+
+    if (!answered || res.status != STATUS_OK) {
+        cout << command << " failed" << endl;
+        return 1;
+    }
+
+    cout << command << " done" << endl;
+
+    if (req.op == OP_RELAYOUT) {
+        cout << "Nodes moved: " << res.payload << endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // ./run_loadgen --control <trace-start|trace-stop|relayout> [socket path]
+    if (argc > 2 && string(argv[1]) == "--control") {
+        return RunControl(argv[2], argc > 3 ? argv[3] : DEFAULT_SOCKET_PATH);
+    }
+
+    string socket_path = argc > 1 ? argv[1] : DEFAULT_SOCKET_PATH;
+    int connection_count = argc > 2 ? atoi(argv[2]) : 8;
+    int requests_per_connection = argc > 3 ? atoi(argv[3]) : 100000;
+    int pipeline_depth = argc > 4 ? atoi(argv[4]) : 32;
+    string dictionary_path = argc > 5 ? argv[5] : "../data/words.txt";
+
+    if (connection_count < 1 || requests_per_connection < 1 || pipeline_depth < 1) {
+        cout << "Usage: ./run_loadgen [socket path] [connections] [requests per connection] [pipeline depth] [dictionary file]" << endl;
+        return 1;
+    }
+
+    // Keys are picked from the same dictionary the server loads, so most searches hit
+    vector<string> words;
+    fstream dictfile;
+    dictfile.open(dictionary_path, ios::in);
+
+    if (dictfile.is_open()) {
+        string word;
+
+        while(getline(dictfile, word)) {
+            if (!word.empty()) {
+                words.push_back(word);
+            }
+        }
+
+        dictfile.close();
+    }
+
+    if (words.empty()) {
+        cout << "Couldn't read any words from " << dictionary_path << endl;
+        return 1;
+    }
+
+    cout << "Sending " << requests_per_connection << " requests on each of " << connection_count
+         << " connections, " << pipeline_depth << " in flight at a time..." << endl;
+
+    vector<connection_result> results(connection_count);
+    vector<thread> threads;
+    steady_clock::time_point start = steady_clock::now();
+
+    for (int i = 0; i < connection_count; i++) {
+        threads.push_back(thread(RunConnection, socket_path, cref(words), requests_per_connection, pipeline_depth, i, ref(results.at(i))));
+    }
+
+    for (auto& connection_thread : threads) {
+        connection_thread.join();
+    }
+
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    vector<double> latencies;
+    int errors = 0;
+
+    for (auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+        errors += result.errors;
+    }
+
+    sort(latencies.begin(), latencies.end());
+
+    cout << endl;
+    cout << "Completed requests: " << latencies.size() << endl;
+    cout << "Errors:             " << errors << endl;
+    cout << "QPS:                " << (size_t)(latencies.size() / seconds) << endl;
+    cout << "p50 latency:        " << Percentile(latencies, 50) << " us" << endl;
+    cout << "p99 latency:        " << Percentile(latencies, 99) << " us" << endl;
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#ifndef PROTOCOL_H__
+#define PROTOCOL_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+// Binary protocol shared by run_server and run_loadgen. Both ends run on the same
+// machine, so numbers are sent in the machine's own byte order.
+//
+// Request:  [uint8 op][uint32 id][uint16 key length][key]
+// Response: [uint32 id][uint8 status][uint32 payload length][payload]
+//
+// The id is picked by the client and sent back with the response. Reads on one connection
+// can be answered out of order, so clients should match responses by id. Writes are never
+// reordered with anything else on the same connection: a write sees every request sent
+// before it, and every request sent after it sees the write.
+
+const char* const DEFAULT_SOCKET_PATH = "/tmp/trie.sock";
+
+const uint8_t OP_SEARCH = 1;    // payload is empty; status says whether the word was found
+const uint8_t OP_SUGGEST = 2;   // payload is the suggestions for the prefix, separated by '\n'
+const uint8_t OP_INSERT = 3;    // payload is empty
+const uint8_t OP_TRACE_START = 4;   // key is ignored; starts counting node visits, clearing earlier counts
+const uint8_t OP_TRACE_STOP = 5;    // key is ignored; stops counting node visits
+const uint8_t OP_RELAYOUT = 6;      // key is ignored; payload is the number of nodes moved by RelayoutByTrace
+
+const uint8_t STATUS_OK = 0;
+const uint8_t STATUS_NOT_FOUND = 1;
+const uint8_t STATUS_BAD_REQUEST = 2;
+
+// Returns true for requests that change the dictionary or its trace, which need it to themselves
+inline bool IsWriteOp(uint8_t op) {
+    return op == OP_INSERT || op == OP_TRACE_START || op == OP_TRACE_STOP || op == OP_RELAYOUT;
+}
+
+const size_t REQUEST_HEADER_SIZE = 7;
+const size_t RESPONSE_HEADER_SIZE = 9;
+
+// Keys longer than this are answered with STATUS_BAD_REQUEST. The key is still read in
+// full first; the 16 bit length field is what limits how much one request can make the
+// server buffer (64KB).
+const size_t MAX_KEY_LENGTH = 1024;
+
+struct request {
+    uint8_t op;
+    uint32_t id;
+    string key;
+};
+
+struct response {
+    uint32_t id;
+    uint8_t status;
+    string payload;
+};
+
+// Appends an encoded request to the end of the buffer
+inline void EncodeRequest(string& buffer, const request& req) {
+    char header[REQUEST_HEADER_SIZE];
+    uint16_t length = req.key.length();
+
+    header[0] = req.op;
+    memcpy(header + 1, &req.id, sizeof(req.id));
+    memcpy(header + 5, &length, sizeof(length));
+
+    buffer.append(header, REQUEST_HEADER_SIZE);
+    buffer.append(req.key);
+}
+
+// Appends an encoded response to the end of the buffer
+inline void EncodeResponse(string& buffer, const response& res) {
+    char header[RESPONSE_HEADER_SIZE];
+    uint32_t length = res.payload.length();
+
+    memcpy(header, &res.id, sizeof(res.id));
+    header[4] = res.status;
+    memcpy(header + 5, &length, sizeof(length));
+
+    buffer.append(header, RESPONSE_HEADER_SIZE);
+    buffer.append(res.payload);
+}
+
+// Decodes the request starting at offset in the buffer. Returns the number of bytes it
+// took up, or 0 if the whole request hasn't arrived yet.
+inline size_t DecodeRequest(const string& buffer, size_t offset, request& req) {
+    if (buffer.length() - offset < REQUEST_HEADER_SIZE) {
+        return 0;
+    }
+
+    uint16_t length;
+    req.op = buffer[offset];
+    memcpy(&req.id, buffer.data() + offset + 1, sizeof(req.id));
+    memcpy(&length, buffer.data() + offset + 5, sizeof(length));
+
+    if (buffer.length() - offset - REQUEST_HEADER_SIZE < length) {
+        return 0;
+    }
+
+    req.key = buffer.substr(offset + REQUEST_HEADER_SIZE, length);
+
+    return REQUEST_HEADER_SIZE + length;
+}
+
+// Decodes the response starting at offset in the buffer. Returns the number of bytes it
+// took up, or 0 if the whole response hasn't arrived yet.
+inline size_t DecodeResponse(const string& buffer, size_t offset, response& res) {
+    if (buffer.length() - offset < RESPONSE_HEADER_SIZE) {
+        return 0;
+    }
+
+    uint32_t length;
+    memcpy(&res.id, buffer.data() + offset, sizeof(res.id));
+    res.status = buffer[offset + 4];
+    memcpy(&length, buffer.data() + offset + 5, sizeof(length));
+
+    if (buffer.length() - offset - RESPONSE_HEADER_SIZE < length) {
+        return 0;
+    }
+
+    res.payload = buffer.substr(offset + RESPONSE_HEADER_SIZE, length);
+
+    return RESPONSE_HEADER_SIZE + length;
+}
+
+#endif  // PROTOCOL_H__
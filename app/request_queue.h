@@ -0,0 +1,61 @@
+#ifndef REQUEST_QUEUE_H__
+#define REQUEST_QUEUE_H__
+
+#include <deque>
+#include <vector>
+#include "protocol.h"
+
+using namespace std;
+
+// Keeps the requests from one connection in the order the client sent them around writes.
+// Reads that come one after another can run at the same time and finish in any order, but a
+// write only runs once everything sent before it has finished, and nothing sent after it runs
+// until it has finished too.
+class RequestQueue {
+    public:
+        RequestQueue() : running(0), write_running(false) {}
+
+        // Adds a request that just arrived on the connection
+        void Add(const request& req) {
+            held.push_back(req);
+        }
+
+        // Moves every request that is allowed to run now onto the end of ready
+        void Release(vector<request>& ready) {
+            while (!held.empty() && !write_running) {
+                if (IsWriteOp(held.front().op)) {
+                    // A write has to wait for everything before it
+                    if (running > 0) {
+                        break;
+                    }
+
+                    write_running = true;
+                }
+
+                ready.push_back(held.front());
+                held.pop_front();
+                running++;
+            }
+        }
+
+        // Marks a request that was handed out by Release as finished
+        void Finish(uint8_t op) {
+            running--;
+
+            if (IsWriteOp(op)) {
+                write_running = false;
+            }
+        }
+
+        // Returns true when there are no requests waiting or running
+        bool Idle() {
+            return held.empty() && running == 0;
+        }
+
+    private:
+        deque<request> held;
+        int running;
+        bool write_running;
+};
+
+#endif  // REQUEST_QUEUE_H__
@@ -0,0 +1,595 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <csignal>
+#include <cerrno>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../code/Trie.h"
+#include "protocol.h"
+#include "request_queue.h"
+
+using namespace std;
+
+// Dictionary server. One thread runs an epoll loop that accepts connections and reads
+// requests off the socket. Each connection's requests go through a RequestQueue, so a
+// write never overtakes or gets overtaken by the requests around it on that connection.
+// Every request that's ready to run after one pass of the loop is gathered into a batch.
+// Reads are sorted by key and split into slices for the worker threads, which hand each
+// slice's keys to the trie as a group so that neighbouring keys share the walk down their
+// common prefix. Writes go in slices of their own. Workers send their responses back to the loop, which writes
+// them out and lets each connection's next requests run.
+
+// Most requests a worker handles in one go
+const size_t BATCH_SLICE_SIZE = 64;
+
+// A request along with the connection it came in on
+struct pending_request {
+    unsigned long connection_id;
+    request req;
+};
+
+// A response waiting to be written back to its connection
+struct completed_response {
+    unsigned long connection_id;
+    uint8_t op;
+    string bytes;
+};
+
+struct connection {
+    int fd;
+    string in_buffer;
+    string out_buffer;
+    RequestQueue queue;
+    bool read_closed;   // the client won't send anything more, but may still be waiting for responses
+};
+
+Trie trie;
+pthread_rwlock_t trie_lock;     // set up in main to prefer writers
+
+mutex work_mutex;
+condition_variable work_ready;
+deque<vector<pending_request>> work_queue;
+
+mutex done_mutex;
+vector<completed_response> done_queue;
+int done_event_fd;
+
+volatile sig_atomic_t stopping = 0;
+
+void HandleSignal(int signal_number) {
+    stopping = 1;
+}
+
+// Keys have to be words the trie could hold, and no longer than the protocol allows
+bool IsValidKey(const string& key) {
+    return key.length() <= MAX_KEY_LENGTH && trie.ValidateWord(key);
+}
+
+response RunRequest(const request& req) {
+    response res;
+    res.id = req.id;
+    res.status = STATUS_OK;
+
+    // Trace controls don't take a key
+    if (req.op == OP_TRACE_START) {
+        trie.StartTrace();
+        return res;
+    }
+    else if (req.op == OP_TRACE_STOP) {
+        trie.StopTrace();
+        return res;
+    }
+    else if (req.op == OP_RELAYOUT) {
+        res.payload = to_string(trie.RelayoutByTrace());
+        return res;
+    }
+
+    if (!IsValidKey(req.key)) {
+        res.status = STATUS_BAD_REQUEST;
+        return res;
+    }
+
+    if (req.op == OP_SEARCH) {
+        res.status = trie.Search(req.key) ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+    else if (req.op == OP_SUGGEST) {
+        vector<string> suggestions = trie.SuggestionsForPrefix(req.key);
+
+        for (auto suggestion : suggestions) {
+            res.payload += suggestion;
+            res.payload += '\n';
+        }
+    }
+    else if (req.op == OP_INSERT) {
+        trie.Insert(req.key);
+    }
+    else {
+        res.status = STATUS_BAD_REQUEST;
+    }
+
+    return res;
+}
+
+// Answers a slice of reads. The slice is sorted by key, so the searches and the suggestion
+// requests are each handed to the trie as one group, letting neighbouring keys share their walks.
+vector<response> RunReads(const vector<pending_request>& slice) {
+    vector<response> responses(slice.size());
+    vector<size_t> search_positions;
+    vector<string> search_keys;
+    vector<size_t> suggest_positions;
+    vector<string> suggest_keys;
+
+    for (size_t i = 0; i < slice.size(); i++) {
+        const request& req = slice.at(i).req;
+        responses.at(i).id = req.id;
+        responses.at(i).status = STATUS_OK;
+
+        if (!IsValidKey(req.key)) {
+            responses.at(i).status = STATUS_BAD_REQUEST;
+        }
+        else if (req.op == OP_SEARCH) {
+            search_positions.push_back(i);
+            search_keys.push_back(req.key);
+        }
+        else if (req.op == OP_SUGGEST) {
+            suggest_positions.push_back(i);
+            suggest_keys.push_back(req.key);
+        }
+        else {
+            responses.at(i).status = STATUS_BAD_REQUEST;
+        }
+    }
+
+    vector<bool> found = trie.SearchMany(search_keys);
+
+    for (size_t i = 0; i < found.size(); i++) {
+        responses.at(search_positions.at(i)).status = found.at(i) ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    vector<vector<string>> suggestions = trie.SuggestionsForPrefixes(suggest_keys);
+
+    for (size_t i = 0; i < suggestions.size(); i++) {
+        string& payload = responses.at(suggest_positions.at(i)).payload;
+
+        for (auto& suggestion : suggestions.at(i)) {
+            payload += suggestion;
+            payload += '\n';
+        }
+    }
+
+    return responses;
+}
+
+void RunWorker() {
+    while (true) {
+        vector<pending_request> slice;
+
+        {
+            unique_lock<mutex> lock(work_mutex);
+            work_ready.wait(lock, [] { return stopping || !work_queue.empty(); });
+
+            if (work_queue.empty()) {
+                return;
+            }
+
+            slice = move(work_queue.front());
+            work_queue.pop_front();
+        }
+
+        // Lookups can share the trie, but a write needs it to itself.
+        // Slices never mix the two, so the first request says which kind this is.
+        vector<response> results;
+
+        if (IsWriteOp(slice.front().req.op)) {
+            pthread_rwlock_wrlock(&trie_lock);
+
+            for (auto& pending : slice) {
+                results.push_back(RunRequest(pending.req));
+            }
+        }
+        else {
+            pthread_rwlock_rdlock(&trie_lock);
+            results = RunReads(slice);
+        }
+
+        pthread_rwlock_unlock(&trie_lock);
+
+        vector<completed_response> responses;
+
+        for (size_t i = 0; i < slice.size(); i++) {
+            completed_response done;
+            done.connection_id = slice.at(i).connection_id;
+            done.op = slice.at(i).req.op;
+            EncodeResponse(done.bytes, results.at(i));
+            responses.push_back(move(done));
+        }
+
+        {
+            lock_guard<mutex> lock(done_mutex);
+
+            for (auto& done : responses) {
+                done_queue.push_back(move(done));
+            }
+        }
+
+        // Wake up the event loop so it writes the responses out
+        uint64_t one = 1;
+        ssize_t written = write(done_event_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void SetNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Writes as much of the connection's output as the socket will take. Returns false if the connection broke.
+bool FlushConnection(int epoll_fd, connection& conn, unsigned long connection_id) {
+    while (!conn.out_buffer.empty()) {
+        ssize_t written = write(conn.fd, conn.out_buffer.data(), conn.out_buffer.length());
+
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            return false;
+        }
+
+        conn.out_buffer.erase(0, written);
+    }
+
+    // Only ask to hear about the socket being writable while there's something left to write,
+    // and stop listening for reads once the client has finished sending
+    epoll_event event;
+    event.events = (conn.read_closed ? 0 : EPOLLIN) | (conn.out_buffer.empty() ? 0 : EPOLLOUT);
+    event.data.u64 = connection_id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+
+    return true;
+}
+
+// Adds the connection's requests that are allowed to run now to the batch
+void ReleaseRequests(connection& conn, unsigned long connection_id, vector<pending_request>& batch) {
+    vector<request> ready;
+    conn.queue.Release(ready);
+
+    for (auto& req : ready) {
+        pending_request pending;
+        pending.connection_id = connection_id;
+        pending.req = req;
+        batch.push_back(pending);
+    }
+}
+
+// Returns true once the client has finished sending and every response has been written
+bool IsFinished(connection& conn) {
+    return conn.read_closed && conn.queue.Idle() && conn.out_buffer.empty();
+}
+
+// Reads everything waiting on the connection and queues up each complete request.
+// Returns false if the connection broke.
+bool ReadConnection(connection& conn, unsigned long connection_id, vector<pending_request>& batch) {
+    char chunk[65536];
+
+    while (true) {
+        ssize_t received = read(conn.fd, chunk, sizeof(chunk));
+
+        // The client has finished sending. Requests that came in before that still get answered.
+        if (received == 0) {
+            conn.read_closed = true;
+            break;
+        }
+
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            return false;
+        }
+
+        conn.in_buffer.append(chunk, received);
+    }
+
+    size_t offset = 0;
+    request req;
+
+    while (size_t used = DecodeRequest(conn.in_buffer, offset, req)) {
+        conn.queue.Add(req);
+        offset += used;
+    }
+
+    // Keep any partial request until the rest of it arrives
+    conn.in_buffer.erase(0, offset);
+
+    ReleaseRequests(conn, connection_id, batch);
+
+    return true;
+}
+
+// Adds the requests to the work queue in slices of at most BATCH_SLICE_SIZE
+void QueueSlices(const vector<pending_request>& requests) {
+    for (size_t start = 0; start < requests.size(); start += BATCH_SLICE_SIZE) {
+        size_t end = min(requests.size(), start + BATCH_SLICE_SIZE);
+        work_queue.push_back(vector<pending_request>(requests.begin() + start, requests.begin() + end));
+    }
+}
+
+// Splits the batch into reads and writes, sorts the reads by key and hands both to the workers in slices.
+// Every request in the batch was released by its connection's RequestQueue, so they can run in any order.
+void DispatchBatch(vector<pending_request>& batch) {
+    if (batch.empty()) {
+        return;
+    }
+
+    vector<pending_request> reads;
+    vector<pending_request> writes;
+
+    for (auto& pending : batch) {
+        if (IsWriteOp(pending.req.op)) {
+            writes.push_back(pending);
+        }
+        else {
+            reads.push_back(pending);
+        }
+    }
+
+    stable_sort(reads.begin(), reads.end(), [](const pending_request& a, const pending_request& b) {
+        return a.req.key < b.req.key;
+    });
+
+    {
+        lock_guard<mutex> lock(work_mutex);
+        QueueSlices(reads);
+        QueueSlices(writes);
+    }
+
+    work_ready.notify_all();
+    batch.clear();
+}
+
+int main(int argc, char* argv[])
+{
+    string socket_path = argc > 1 ? argv[1] : DEFAULT_SOCKET_PATH;
+    string dictionary_path = argc > 2 ? argv[2] : "../data/words.txt";
+    int worker_count = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+
+    // A socket left behind by an earlier run gets replaced, but anything else at the path is
+    // left alone so that mixing up the arguments can't delete a file
+    struct stat existing;
+
+    if (lstat(socket_path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            cout << socket_path << " already exists and isn't a socket, so it won't be replaced." << endl;
+            return 1;
+        }
+
+        unlink(socket_path.c_str());
+    }
+
+    fstream dictfile;
+    dictfile.open(dictionary_path, ios::in);
+
+    if (dictfile.is_open()) {
+        string word;
+
+        while(getline(dictfile, word)) {
+            trie.Insert(word);
+        }
+
+        dictfile.close();
+    }
+
+    cout << "Loaded " << trie.Size() << " words from " << dictionary_path << endl;
+
+    // Set up the listening socket
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        cout << "Couldn't listen on " << socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    SetNonBlocking(listen_fd);
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    done_event_fd = eventfd(0, EFD_NONBLOCK);
+    int epoll_fd = epoll_create1(0);
+
+    // Connection ids 0 and 1 are saved for the listening socket and the workers' wake up event,
+    // so that a response for a closed connection can't end up on a new one that reused its fd
+    const unsigned long LISTEN_ID = 0;
+    const unsigned long DONE_ID = 1;
+    unsigned long next_connection_id = 2;
+    map<unsigned long, connection> connections;
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_ID;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.u64 = DONE_ID;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, done_event_fd, &event);
+
+    // Writers get the lock as soon as the current readers are done. With the default, a steady
+    // stream of lookups keeps the read lock held and inserts wait for as long as it lasts.
+    pthread_rwlockattr_t lock_attributes;
+    pthread_rwlockattr_init(&lock_attributes);
+    pthread_rwlockattr_setkind_np(&lock_attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&trie_lock, &lock_attributes);
+    pthread_rwlockattr_destroy(&lock_attributes);
+
+    vector<thread> workers;
+
+    for (int i = 0; i < worker_count; i++) {
+        workers.push_back(thread(RunWorker));
+    }
+
+    cout << "Serving on " << socket_path << " with " << worker_count << " worker threads. Press Ctrl-C to stop." << endl;
+
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    vector<pending_request> batch;
+
+    while (!stopping) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            unsigned long id = events[i].data.u64;
+
+            if (id == LISTEN_ID) {
+                int client_fd;
+
+                while ((client_fd = accept(listen_fd, NULL, NULL)) >= 0) {
+                    SetNonBlocking(client_fd);
+
+                    unsigned long connection_id = next_connection_id++;
+                    connection conn;
+                    conn.fd = client_fd;
+                    conn.read_closed = false;
+                    connections[connection_id] = conn;
+
+                    epoll_event client_event;
+                    client_event.events = EPOLLIN;
+                    client_event.data.u64 = connection_id;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event);
+                }
+            }
+            else if (id == DONE_ID) {
+                uint64_t count;
+                ssize_t received = read(done_event_fd, &count, sizeof(count));
+                (void)received;
+
+                vector<completed_response> done;
+
+                {
+                    lock_guard<mutex> lock(done_mutex);
+                    done.swap(done_queue);
+                }
+
+                // Queue up each response on its connection, then write them all out at once
+                set<unsigned long> touched;
+
+                for (auto& done_response : done) {
+                    auto found = connections.find(done_response.connection_id);
+
+                    // The connection closed while the request was being worked on
+                    if (found == connections.end()) {
+                        continue;
+                    }
+
+                    touched.insert(done_response.connection_id);
+                    found->second.out_buffer += done_response.bytes;
+                    found->second.queue.Finish(done_response.op);
+                }
+
+                for (auto connection_id : touched) {
+                    connection& conn = connections[connection_id];
+
+                    // Requests that were waiting on the ones that just finished can run now
+                    ReleaseRequests(conn, connection_id, batch);
+
+                    if (!FlushConnection(epoll_fd, conn, connection_id) || IsFinished(conn)) {
+                        close(conn.fd);
+                        connections.erase(connection_id);
+                    }
+                }
+            }
+            else {
+                auto found = connections.find(id);
+
+                if (found == connections.end()) {
+                    continue;
+                }
+
+                connection& conn = found->second;
+                bool open = true;
+
+                // Once the client has stopped sending, a hang up means it's gone completely and
+                // can't receive the rest of its responses
+                if (conn.read_closed && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    open = false;
+                }
+                else if (!conn.read_closed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    open = ReadConnection(conn, id, batch);
+
+                    // Update which events the connection is listening for if it just stopped sending
+                    if (open && conn.read_closed) {
+                        open = FlushConnection(epoll_fd, conn, id);
+                    }
+                }
+
+                if (open && (events[i].events & EPOLLOUT)) {
+                    open = FlushConnection(epoll_fd, conn, id);
+                }
+
+                if (!open || IsFinished(conn)) {
+                    close(found->second.fd);
+                    connections.erase(found);
+                }
+            }
+        }
+
+        // Everything read in this pass of the loop goes to the workers together
+        DispatchBatch(batch);
+    }
+
+    cout << endl << "Shutting down..." << endl;
+
+    {
+        lock_guard<mutex> lock(work_mutex);
+        stopping = 1;
+    }
+
+    work_ready.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (auto& entry : connections) {
+        close(entry.second.fd);
+    }
+
+    close(listen_fd);
+    close(epoll_fd);
+    close(done_event_fd);
+    unlink(socket_path.c_str());
+    pthread_rwlock_destroy(&trie_lock);
+
+    return 0;
+}
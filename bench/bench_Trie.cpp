@@ -0,0 +1,443 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include "../code/Trie.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Benchmarks for the Trie class. Run from the build/ directory:
+//
+//   ./run_bench tokenize [megabytes]
+//   ./run_bench scan [megabytes] [terms]
+//   ./run_bench setops
+//   ./run_bench layout [words]
+//
+// Each benchmark runs a few times and reports the fastest run, so that one slow run
+// (another process waking up, a cold cache) doesn't hide what the code itself can do.
+
+const int BENCH_REPEATS = 3;
+
+// Returns the seconds the function took to run, fastest out of BENCH_REPEATS runs. If there's
+// a setup function, it runs untimed before each run.
+double TimeBest(function<void()> run, function<void()> setup = nullptr) {
+    double best = 0;
+
+    for (int i = 0; i < BENCH_REPEATS; i++) {
+        if (setup) {
+            setup();
+        }
+
+        steady_clock::time_point start = steady_clock::now();
+        run();
+        double seconds = duration<double>(steady_clock::now() - start).count();
+
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    return best;
+}
+
+vector<string> ReadWords(const string& path) {
+    vector<string> words;
+    fstream dictfile;
+    dictfile.open(path, ios::in);
+
+    if (dictfile.is_open()) {
+        string word;
+
+        while(getline(dictfile, word)) {
+            if (!word.empty()) {
+                words.push_back(word);
+            }
+        }
+
+        dictfile.close();
+    }
+
+    return words;
+}
+
+// Builds about the given number of bytes of text out of random dictionary words. Most words
+// are separated by a space, but some run straight into the next word, and some are followed
+// by punctuation, so the tokenizer and scanner have to deal with all three.
+string MakeText(const vector<string>& words, size_t bytes, int seed) {
+    mt19937 random(seed);
+    uniform_int_distribution<size_t> pick_word(0, words.size() - 1);
+    uniform_int_distribution<int> pick_separator(0, 9);
+    const string separators = "  .,:;-=/[";
+    string text;
+    text.reserve(bytes + 64);
+
+    while (text.length() < bytes) {
+        text += words.at(pick_word(random));
+
+        int roll = pick_separator(random);
+
+        // One time in ten the next word follows straight on
+        if (roll > 0) {
+            text += separators.at(roll);
+        }
+    }
+
+    return text;
+}
+
+void PrintTime(const string& label, double seconds) {
+    cout << "  " << label << ": " << (seconds * 1000) << " ms" << endl;
+}
+
+void PrintRate(const string& label, size_t bytes, double seconds) {
+    cout << "  " << label << ": " << (bytes / seconds / 1e6) << " MB/s (" << (seconds * 1000) << " ms)" << endl;
+}
+
+int BenchTokenize(const vector<string>& dictionary, size_t megabytes) {
+    Trie trie;
+
+    for (auto& word : dictionary) {
+        trie.Insert(word);
+    }
+
+    string text = MakeText(dictionary, megabytes * 1000000, 1);
+    size_t token_count = 0;
+
+    cout << "Tokenize: " << trie.Size() << " words, " << text.length() << " bytes of text" << endl;
+
+    double seconds = TimeBest([&]() {
+        token_count = trie.Tokenize(text).size();
+    });
+    PrintRate("Tokenize", text.length(), seconds);
+
+    // The same text handed over in 64KB chunks, counting tokens instead of keeping them
+    const size_t CHUNK_SIZE = 65536;
+    size_t chunked_count = 0;
+
+    seconds = TimeBest([&]() {
+        chunked_count = 0;
+        tokenize_state state;
+        auto count = [&chunked_count](const string& token) { chunked_count++; };
+
+        for (size_t start = 0; start < text.length(); start += CHUNK_SIZE) {
+            trie.TokenizeChunk(state, text.substr(start, CHUNK_SIZE), count);
+        }
+
+        trie.TokenizeFinish(state, count);
+    });
+    PrintRate("TokenizeChunk", text.length(), seconds);
+
+    cout << "  tokens: " << token_count << (token_count == chunked_count ? "" : " (chunked count differs!)") << endl;
+
+    return token_count == chunked_count ? 0 : 1;
+}
+
+int BenchScan(const vector<string>& dictionary, size_t megabytes, size_t term_count) {
+    // The terms are a random sample of the dictionary, and the text is made from the whole
+    // dictionary, so some words match, some don't, and many contain shorter terms
+    vector<string> terms = dictionary;
+    shuffle(terms.begin(), terms.end(), mt19937(2));
+    terms.resize(min(term_count, terms.size()));
+
+    Trie trie;
+
+    for (auto& term : terms) {
+        trie.Insert(term);
+    }
+
+    trie.CompileMatcher();
+
+    string text = MakeText(dictionary, megabytes * 1000000, 1);
+    size_t match_count = 0;
+
+    cout << "Scan: " << trie.Size() << " terms, " << text.length() << " bytes of text" << endl;
+
+    double seconds = TimeBest([&]() {
+        match_count = 0;
+        trie.ScanAll(text, [&match_count](const string& word, size_t position) { match_count++; });
+    });
+    PrintRate("ScanAll", text.length(), seconds);
+
+    // The same text handed over in 64KB chunks
+    const size_t CHUNK_SIZE = 65536;
+    size_t chunked_count = 0;
+
+    seconds = TimeBest([&]() {
+        chunked_count = 0;
+        scan_state state;
+        auto count = [&chunked_count](const string& word, size_t position) { chunked_count++; };
+
+        for (size_t start = 0; start < text.length(); start += CHUNK_SIZE) {
+            trie.ScanChunk(state, text.substr(start, CHUNK_SIZE), count);
+        }
+    });
+    PrintRate("ScanChunk", text.length(), seconds);
+
+    cout << "  matches: " << match_count << (match_count == chunked_count ? "" : " (chunked count differs!)") << endl;
+
+    return match_count == chunked_count ? 0 : 1;
+}
+
+// Returns every word of the given length made from the letters first_letter onwards
+vector<string> MakeAllWords(char first_letter, int letter_count, int length) {
+    vector<string> words(1, "");
+
+    for (int i = 0; i < length; i++) {
+        vector<string> longer;
+
+        for (auto& word : words) {
+            for (int j = 0; j < letter_count; j++) {
+                longer.push_back(word + (char)(first_letter + j));
+            }
+        }
+
+        words.swap(longer);
+    }
+
+    return words;
+}
+
+// Returns a copy of the trie, made with a structural merge into an empty trie
+void CopyTrie(Trie& copy, Trie& original) {
+    copy = Trie();
+    copy.Merge(original);
+}
+
+int BenchSetOperations() {
+    // Two tries of a million 6 letter words each. The first uses the letters a to j and
+    // the second b to k, so about half of each one's words are in the other.
+    Trie first;
+    Trie second;
+
+    for (auto& word : MakeAllWords('a', 10, 6)) {
+        first.Insert(word);
+    }
+
+    for (auto& word : MakeAllWords('b', 10, 6)) {
+        second.Insert(word);
+    }
+
+    cout << "Set operations: " << first.Size() << " and " << second.Size() << " words, "
+         << thread::hardware_concurrency() << " hardware threads" << endl;
+
+    Trie result;
+    auto setup = [&]() { CopyTrie(result, first); };
+
+    // The structural operations, against doing the same thing one word at a time
+    PrintTime("Merge", TimeBest([&]() { result.Merge(second); }, setup));
+    PrintTime("GetAllWords + Insert", TimeBest([&]() {
+        for (auto& word : second.GetAllWords()) {
+            result.Insert(word);
+        }
+    }, setup));
+
+    PrintTime("Intersect", TimeBest([&]() { result.Intersect(second); }, setup));
+    PrintTime("GetAllWords + Search + Remove", TimeBest([&]() {
+        for (auto& word : result.GetAllWords()) {
+            if (!second.Search(word)) {
+                result.Remove(word);
+            }
+        }
+    }, setup));
+
+    PrintTime("Difference", TimeBest([&]() { result.Difference(second); }, setup));
+    PrintTime("GetAllWords + Remove", TimeBest([&]() {
+        for (auto& word : second.GetAllWords()) {
+            result.Remove(word);
+        }
+    }, setup));
+
+    // What it costs to hand the root's branches to threads, against how long a merge takes
+    // per word. Splitting a merge between two cores saves at most half its time, so it only
+    // pays off once half the merge takes longer than starting and joining the threads.
+    double thread_seconds = TimeBest([]() {
+        vector<thread> threads;
+
+        for (int i = 0; i + 1 < ALPHABET_SIZE; i++) {
+            threads.push_back(thread([]() {}));
+        }
+
+        for (auto& branch_thread : threads) {
+            branch_thread.join();
+        }
+    });
+
+    Trie small_first;
+    Trie small_second;
+
+    // Kept small enough that the merge itself never starts threads
+    for (auto& word : MakeAllWords('a', 10, 3)) {
+        small_first.Insert(word);
+    }
+
+    for (auto& word : MakeAllWords('b', 10, 3)) {
+        small_second.Insert(word);
+    }
+
+    double merge_seconds = TimeBest([&]() { result.Merge(small_second); }, [&]() { CopyTrie(result, small_first); });
+    double seconds_per_word = merge_seconds / (small_first.Size() + small_second.Size());
+
+    cout << "  Starting and joining " << (ALPHABET_SIZE - 1) << " threads: " << (thread_seconds * 1e6) << " us" << endl;
+    cout << "  Merge per word: " << (seconds_per_word * 1e9) << " ns" << endl;
+    cout << "  Break-even size: " << (size_t)(2 * thread_seconds / seconds_per_word) << " words" << endl;
+
+    return 0;
+}
+
+// Returns random words of 5 to 12 letters, all different, in random order
+vector<string> MakeRandomWords(size_t count, int seed) {
+    mt19937 random(seed);
+    uniform_int_distribution<int> pick_length(5, 12);
+    uniform_int_distribution<int> pick_letter(0, ALPHABET_SIZE - 1);
+    vector<string> words;
+
+    for (size_t i = 0; i < count; i++) {
+        string word(pick_length(random), 'a');
+
+        for (auto& letter : word) {
+            letter = 'a' + pick_letter(random);
+        }
+
+        words.push_back(word);
+    }
+
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+    shuffle(words.begin(), words.end(), random);
+
+    return words;
+}
+
+struct layout_query {
+    bool suggest;
+    string key;
+};
+
+// Picks queries with the same mix as run_loadgen (searches, and suggestions for 3 letter
+// prefixes), but with a Zipf distribution over the words: a few are asked for all the time
+// and most hardly ever, the kind of skew a trace is meant to pick up
+vector<layout_query> MakeSkewedQueries(const vector<string>& words, size_t count, int seed) {
+    vector<double> cumulative(words.size());
+    double total = 0;
+
+    for (size_t i = 0; i < words.size(); i++) {
+        total += 1.0 / (i + 1);
+        cumulative.at(i) = total;
+    }
+
+    mt19937 random(seed);
+    uniform_real_distribution<double> pick_weight(0, total);
+    uniform_int_distribution<int> pick_op(0, 94);
+    vector<layout_query> queries;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t rank = lower_bound(cumulative.begin(), cumulative.end(), pick_weight(random)) - cumulative.begin();
+        layout_query query;
+        query.suggest = pick_op(random) >= 80;
+        query.key = query.suggest ? words.at(rank).substr(0, 3) : words.at(rank);
+        queries.push_back(query);
+    }
+
+    return queries;
+}
+
+// Runs the queries, prints the total time and the p50/p99 of a single query
+void TimeQueries(const string& label, Trie& trie, const vector<layout_query>& queries) {
+    vector<double> latencies;
+    latencies.reserve(queries.size() * BENCH_REPEATS);
+
+    double seconds = TimeBest([&]() {
+        for (auto& query : queries) {
+            steady_clock::time_point start = steady_clock::now();
+
+            if (query.suggest) {
+                trie.SuggestionsForPrefix(query.key);
+            }
+            else {
+                trie.Search(query.key);
+            }
+
+            latencies.push_back(duration<double, micro>(steady_clock::now() - start).count());
+        }
+    });
+
+    sort(latencies.begin(), latencies.end());
+
+    cout << "  " << label << ": " << (seconds * 1000) << " ms, p50 " << latencies.at(latencies.size() / 2)
+         << " us, p99 " << latencies.at(latencies.size() * 99 / 100) << " us" << endl;
+}
+
+int BenchLayout(size_t word_count) {
+    // Inserting the words in random order leaves related nodes scattered over the heap
+    vector<string> words = MakeRandomWords(word_count, 3);
+    Trie trie;
+
+    for (auto& word : words) {
+        trie.Insert(word);
+    }
+
+    // The trace is recorded with one set of queries and the timing uses another, drawn the same way
+    vector<layout_query> trace_queries = MakeSkewedQueries(words, 200000, 4);
+    vector<layout_query> queries = MakeSkewedQueries(words, 200000, 5);
+
+    cout << "Layout: " << trie.Size() << " words inserted in random order, " << queries.size() << " skewed queries" << endl;
+
+    TimeQueries("As inserted", trie, queries);
+
+    trie.Compact();
+    TimeQueries("Compact", trie, queries);
+
+    trie.StartTrace();
+
+    for (auto& query : trace_queries) {
+        if (query.suggest) {
+            trie.SuggestionsForPrefix(query.key);
+        }
+        else {
+            trie.Search(query.key);
+        }
+    }
+
+    trie.StopTrace();
+    trie.RelayoutByTrace();
+    TimeQueries("RelayoutByTrace", trie, queries);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    string benchmark = argc > 1 ? argv[1] : "";
+    vector<string> dictionary = ReadWords("../data/words.txt");
+
+    if (dictionary.empty()) {
+        cout << "Couldn't read ../data/words.txt. Run the benchmarks from the build/ directory." << endl;
+        return 1;
+    }
+
+    if (benchmark == "tokenize") {
+        return BenchTokenize(dictionary, argc > 2 ? atoi(argv[2]) : 20);
+    }
+
+    if (benchmark == "scan") {
+        return BenchScan(dictionary, argc > 2 ? atoi(argv[2]) : 20, argc > 3 ? atoi(argv[3]) : 5000);
+    }
+
+    if (benchmark == "setops") {
+        return BenchSetOperations();
+    }
+
+    if (benchmark == "layout") {
+        return BenchLayout(argc > 2 ? atoi(argv[2]) : 300000);
+    }
+
+    cout << "Usage: ./run_bench tokenize [megabytes]" << endl;
+    cout << "       ./run_bench scan [megabytes] [terms]" << endl;
+    cout << "       ./run_bench setops" << endl;
+    cout << "       ./run_bench layout [words]" << endl;
+
+    return 1;
+}
@@ -1,8 +1,16 @@
 #include "Trie.h"
 
+#include <queue>
+#include <thread>
+#include <system_error>
+
 Trie::Trie() {
     shared_ptr<trie_node> root = InitTrieNode('\0');
     SetRoot(root);
+
+    tracing = false;
+    matcher_compiled = false;
+    matcher_version = 0;
 }
 
 Trie::~Trie() {}
@@ -15,6 +23,12 @@ void Trie::Insert(const string& word) {
         return;
     }
 
+    // Duplicates don't change anything, and the word counts should only go up for new words
+    if (word.length() == 0 || FindWord(word, false)) { return; }
+
+    // The matcher's links no longer cover every word
+    matcher_compiled = false;
+
     // Starting at the root, traverse down the trie's nodes, one step for each character in the word
     shared_ptr<trie_node> root = GetRoot();
     
@@ -22,6 +36,9 @@ void Trie::Insert(const string& word) {
 }
 
 void Trie::RecursiveInsert(shared_ptr<trie_node>& node, const string& word, int current_letter_index) {
+    // Every node along the word's path gains a word below it, including the last letter's node
+    node->word_count++;
+
     // Base case: The index of the letter has surpassed end of word
     if (current_letter_index >= word.length()) {
         return;
@@ -67,11 +84,21 @@ void Trie::Remove(const string& word) {
     if (!ValidateWord(word)) { return; }
 
     // If the word is not in the trie, don't do anything
-    if (!Search(word)) { return; }
+    if (!FindWord(word, false)) { return; }
+
+    // Nodes may be deleted below, so the matcher's links can't be trusted anymore
+    matcher_compiled = false;
 
     // Traverse tree and create list of letter nodes for each character in word.
     vector<shared_ptr<trie_node>> letter_node_list = BuildLetterNodeList(word);
 
+    // Every node along the word's path loses a word below it
+    GetRoot()->word_count--;
+
+    for (auto letter_node : letter_node_list) {
+        letter_node->word_count--;
+    }
+
     // Iterate through the list starting at the last letter of the word (done by iterating in reverse)
     for (int i = word.length() - 1; i >= 0; i--) {
         shared_ptr<trie_node> current_node = letter_node_list.at(i);
@@ -145,6 +172,10 @@ vector<shared_ptr<trie_node>> Trie::GetChildLetters(shared_ptr<trie_node> node)
 }
 
 bool Trie::Search(const string& word) {
+    return FindWord(word, tracing);
+}
+
+bool Trie::FindWord(const string& word, bool record_visits) {
     // If word is invalid, don't do anything and return false
     if (!ValidateWord(word)) {
         return false;
@@ -154,6 +185,10 @@ bool Trie::Search(const string& word) {
     shared_ptr<trie_node> cursor = GetRoot();
     bool found = false;
 
+    if (record_visits) {
+        RecordVisit(cursor.get());
+    }
+
     // For each letter in the word, traverse the trie tree in order of the letters.
     for (int i = 0; i < word.length(); i++) {
         char letter = word.at(i);
@@ -163,6 +198,10 @@ bool Trie::Search(const string& word) {
             int letter_index = LetterIndex(letter);
             cursor = cursor->children.at(letter_index);
 
+            if (record_visits) {
+                RecordVisit(cursor.get());
+            }
+
             // If each letter has been found up until now, and the last letter is at a node 
             // that is the end of the word, the word was found.
             if (i == (word.length() - 1) && cursor->is_end_of_word) {
@@ -178,6 +217,87 @@ bool Trie::Search(const string& word) {
     return found;
 }
 
+vector<bool> Trie::SearchMany(const vector<string>& words) {
+    vector<bool> found;
+    vector<const shared_ptr<trie_node>*> path;
+    string previous = "";
+
+    for (auto& word : words) {
+        // Same as Search, invalid and empty words are never found
+        if (word.length() == 0 || !ValidateWord(word)) {
+            found.push_back(false);
+            continue;
+        }
+
+        const shared_ptr<trie_node>* node = FindNodeFrom(path, previous, word);
+        found.push_back(node && (*node)->is_end_of_word);
+    }
+
+    return found;
+}
+
+vector<vector<string>> Trie::SuggestionsForPrefixes(const vector<string>& prefixes) {
+    vector<vector<string>> all_suggestions;
+    vector<const shared_ptr<trie_node>*> path;
+    string previous = "";
+
+    for (auto& prefix : prefixes) {
+        vector<string> suggestions;
+
+        // Same as SuggestionsForPrefix, invalid and empty prefixes have no suggestions
+        if (prefix.length() > 0 && ValidateWord(prefix)) {
+            const shared_ptr<trie_node>* prefix_last_letter = FindNodeFrom(path, previous, prefix);
+
+            if (prefix_last_letter) {
+                RecursiveSuggestionsForPrefix(suggestions, *prefix_last_letter, prefix);
+            }
+        }
+
+        all_suggestions.push_back(suggestions);
+    }
+
+    return all_suggestions;
+}
+
+const shared_ptr<trie_node>* Trie::FindNodeFrom(vector<const shared_ptr<trie_node>*>& path, string& previous, const string& word) {
+    if (path.empty()) {
+        path.push_back(&root);
+    }
+
+    // Count how many letters the word shares with the previous one that the previous walk
+    // actually got through. The walk can pick up from the node at the end of those letters.
+    size_t shared = 0;
+
+    while (shared < word.length() && shared < previous.length() && shared + 1 < path.size() && word.at(shared) == previous.at(shared)) {
+        shared++;
+    }
+
+    path.resize(shared + 1);
+    previous = word;
+
+    bool found = true;
+
+    for (size_t i = shared; i < word.length(); i++) {
+        const shared_ptr<trie_node>& child = (*path.back())->children.at(LetterIndex(word.at(i)));
+
+        if (!child) {
+            found = false;
+            break;
+        }
+
+        path.push_back(&child);
+    }
+
+    // Count the same nodes Search would have visited, even though part of the walk was shared
+    if (tracing) {
+        for (auto slot : path) {
+            RecordVisit(slot->get());
+        }
+    }
+
+    return found ? path.back() : NULL;
+}
+
 vector<string> Trie::SuggestionsForPrefix(string prefix) {
     vector<string> suggestions;
 
@@ -213,6 +333,10 @@ void Trie::RecursiveSuggestionsForPrefix(vector<string>& suggestions, shared_ptr
 
     // If there are children, recursively check each child
     for (auto child : children) {
+        if (tracing) {
+            RecordVisit(child.get());
+        }
+
         // Build onto the prefix by adding the next letter in the sequence
         string prefix_with_child = prefix + child->letter;
 
@@ -222,6 +346,10 @@ void Trie::RecursiveSuggestionsForPrefix(vector<string>& suggestions, shared_ptr
 
 shared_ptr<trie_node> Trie::FindEndOfPrefix(string prefix) {
     shared_ptr<trie_node> cursor = GetRoot();
+
+    if (tracing) {
+        RecordVisit(cursor.get());
+    }
     
     // Traverse trie for each character in the prefix until we find the end
     for (int i = 0; i < prefix.length(); i++) {
@@ -235,15 +363,373 @@ shared_ptr<trie_node> Trie::FindEndOfPrefix(string prefix) {
         if (!cursor) {
             break;
         }
+
+        if (tracing) {
+            RecordVisit(cursor.get());
+        }
     }
 
     return cursor;
 }
 
+string Trie::LongestPrefixOf(const string& text) {
+    size_t length = LongestPrefixLength(text, 0);
+
+    return text.substr(0, length);
+}
+
+void Trie::AllPrefixesOf(const string& text, function<void(const string&)> callback) {
+    // Raw pointer is used for the walk so we don't pay for a reference count update on every step
+    trie_node* cursor = GetRoot().get();
+
+    // Walk down the trie one letter at a time. Every end-of-word node we pass on the
+    // way is a word that is a prefix of the text.
+    for (size_t i = 0; i < text.length(); i++) {
+        char letter = text.at(i);
+
+        // Anything that isn't a lowercase letter can't be in the trie, so stop here
+        if (letter < 'a' || letter > 'z') {
+            break;
+        }
+
+        cursor = cursor->children.at(LetterIndex(letter)).get();
+
+        // If the letter node doesn't exist, no longer words can match
+        if (!cursor) {
+            break;
+        }
+
+        if (cursor->is_end_of_word) {
+            callback(text.substr(0, i + 1));
+        }
+    }
+}
+
+vector<string> Trie::Tokenize(const string& text) {
+    vector<string> tokens;
+
+    TokenizeBuffer(text, true, [&tokens](const string& token) { tokens.push_back(token); });
+
+    return tokens;
+}
+
+void Trie::TokenizeChunk(tokenize_state& state, const string& chunk, function<void(const string&)> callback) {
+    state.pending += chunk;
+
+    // Only the characters whose tokens are settled are let go of. What's left is never longer
+    // than the longest word, since a walk can't keep going past that.
+    size_t used = TokenizeBuffer(state.pending, false, callback);
+    state.pending.erase(0, used);
+}
+
+void Trie::TokenizeFinish(tokenize_state& state, function<void(const string&)> callback) {
+    TokenizeBuffer(state.pending, true, callback);
+    state.pending.clear();
+}
+
+size_t Trie::TokenizeBuffer(const string& text, bool final, function<void(const string&)> callback) {
+    size_t position = 0;
+
+    while (position < text.length()) {
+        bool reached_end;
+        size_t length = LongestPrefixLength(text, position, reached_end);
+
+        // A longer word might still match here once more text arrives, so wait for it
+        if (reached_end && !final) {
+            break;
+        }
+
+        // If no word starts here, skip over the character and try the next one
+        if (length == 0) {
+            position++;
+        }
+        else {
+            callback(text.substr(position, length));
+            position += length;
+        }
+    }
+
+    return position;
+}
+
+size_t Trie::LongestPrefixLength(const string& text, size_t start) {
+    bool reached_end;
+
+    return LongestPrefixLength(text, start, reached_end);
+}
+
+size_t Trie::LongestPrefixLength(const string& text, size_t start, bool& reached_end) {
+    trie_node* cursor = GetRoot().get();
+    size_t longest = 0;
+
+    reached_end = false;
+
+    for (size_t i = start; i < text.length(); i++) {
+        char letter = text[i];
+
+        if (letter < 'a' || letter > 'z') {
+            return longest;
+        }
+
+        cursor = cursor->children[LetterIndex(letter)].get();
+
+        if (!cursor) {
+            return longest;
+        }
+
+        // Remember the end of the longest word found so far
+        if (cursor->is_end_of_word) {
+            longest = i - start + 1;
+        }
+    }
+
+    reached_end = true;
+
+    return longest;
+}
+
+void Trie::CompileMatcher() {
+    vector<trie_node*> nodes;
+    vector<int> fail;
+
+    matcher.next.assign(MATCHER_COLUMNS, 0);
+    matcher.depth.assign(1, 0);
+    matcher.match.assign(1, -1);
+    matcher.next_match.assign(1, -1);
+    nodes.push_back(GetRoot().get());
+    fail.push_back(0);
+
+    // States are numbered breadth first, since a state's failure link always points to a
+    // shallower state whose row of the table is already complete. The nodes vector doubles
+    // as the queue.
+    for (size_t state = 0; state < nodes.size(); state++) {
+        trie_node* node = nodes.at(state);
+
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            trie_node* child = node->children.at(i).get();
+
+            // Without a child for the letter, the scan goes wherever the failure state goes on it
+            if (!child) {
+                matcher.next.at(state * MATCHER_COLUMNS + i) = state == 0 ? 0 : matcher.next.at(fail.at(state) * MATCHER_COLUMNS + i);
+                continue;
+            }
+
+            int child_state = nodes.size();
+
+            // The child's failure state is where the parent's failure state goes on the same letter
+            int child_fail = state == 0 ? 0 : matcher.next.at(fail.at(state) * MATCHER_COLUMNS + i);
+
+            matcher.next.at(state * MATCHER_COLUMNS + i) = child_state;
+            nodes.push_back(child);
+            fail.push_back(child_fail);
+
+            // Any character that isn't a letter sends the scan back to the root
+            matcher.next.resize(matcher.next.size() + MATCHER_COLUMNS, 0);
+            matcher.depth.push_back(matcher.depth.at(state) + 1);
+            matcher.next_match.push_back(matcher.match.at(child_fail));
+            matcher.match.push_back(child->is_end_of_word ? child_state : matcher.match.at(child_fail));
+        }
+    }
+
+    matcher_compiled = true;
+    matcher_version++;
+}
+
+void Trie::ScanAll(const string& text, function<void(const string&, size_t)> callback) {
+    scan_state state;
+
+    ScanChunk(state, text, callback);
+}
+
+void Trie::ScanChunk(scan_state& state, const string& chunk, function<void(const string&, size_t)> callback) {
+    if (!matcher_compiled) {
+        CompileMatcher();
+    }
+
+    // If the matcher was recompiled since the last chunk, the saved state might not mean the same thing anymore
+    if (state.version != matcher_version) {
+        state.state = 0;
+        state.tail.clear();
+        state.version = matcher_version;
+    }
+
+    // Plain pointers into the tables, so the loop below is just array lookups
+    const int* next = matcher.next.data();
+    const int* depth = matcher.depth.data();
+    const int* match = matcher.match.data();
+    const int* next_match = matcher.next_match.data();
+
+    int current = state.state;
+    string word;
+
+    for (size_t i = 0; i < chunk.length(); i++) {
+        unsigned int column = (unsigned char)chunk[i] - 'a';
+
+        // Anything that isn't a lowercase letter goes in the last column
+        if (column >= ALPHABET_SIZE) {
+            column = ALPHABET_SIZE;
+        }
+
+        current = next[current * MATCHER_COLUMNS + column];
+
+        // Report the longest word ending here, if any, and every shorter word ending with it
+        for (int found = match[current]; found >= 0; found = next_match[found]) {
+            size_t length = depth[found];
+            size_t scanned = i + 1;
+
+            // The word buffer is reused, so short words don't need an allocation each
+            if (length <= scanned) {
+                word.assign(chunk, scanned - length, length);
+            }
+            else {
+                // The match started in an earlier chunk
+                word.assign(state.tail, state.tail.length() - (length - scanned), length - scanned);
+                word.append(chunk, 0, scanned);
+            }
+
+            callback(word, state.offset + scanned - length);
+        }
+    }
+
+    // Only the characters the current state stands for can be part of a match that ends in a later chunk
+    size_t keep = depth[current];
+
+    if (chunk.length() >= keep) {
+        state.tail = chunk.substr(chunk.length() - keep);
+    }
+    else {
+        state.tail = state.tail.substr(state.tail.length() - (keep - chunk.length())) + chunk;
+    }
+
+    state.state = current;
+    state.offset += chunk.length();
+}
+
 int Trie::Size() {
-    vector<string> all_words = GetAllWords();
+    return GetRoot()->word_count;
+}
 
-    return all_words.size();
+int Trie::Rank(const string& word) {
+    if (!ValidateWord(word)) {
+        return -1;
+    }
+
+    trie_node* cursor = GetRoot().get();
+    int rank = 0;
+
+    for (size_t i = 0; i < word.length(); i++) {
+        // The word the cursor stands for is a prefix of the given word, so it comes first
+        if (cursor->is_end_of_word) {
+            rank++;
+        }
+
+        // All the words under letters before this one come first too. Children are
+        // stored in alphabetical order, so these are the children before the letter's index.
+        int letter_index = LetterIndex(word.at(i));
+
+        for (int j = 0; j < letter_index; j++) {
+            if (cursor->children.at(j)) {
+                rank += cursor->children.at(j)->word_count;
+            }
+        }
+
+        cursor = cursor->children.at(letter_index).get();
+
+        // If the letter isn't there, nothing further down can come before the word
+        if (!cursor) {
+            break;
+        }
+    }
+
+    return rank;
+}
+
+string Trie::Select(int index) {
+    string word = "";
+
+    if (index < 0 || index >= Size()) {
+        return word;
+    }
+
+    trie_node* cursor = GetRoot().get();
+
+    // Walk down the trie, skipping over whole subtrees until the index falls inside one
+    while (true) {
+        // A word ending at the cursor comes before all the words below it
+        if (cursor->is_end_of_word) {
+            if (index == 0) {
+                return word;
+            }
+
+            index--;
+        }
+
+        for (auto child : cursor->children) {
+            if (!child) {
+                continue;
+            }
+
+            if (index < child->word_count) {
+                cursor = child.get();
+                word += child->letter;
+                break;
+            }
+
+            index -= child->word_count;
+        }
+    }
+}
+
+int Trie::CountRange(const string& lo, const string& hi) {
+    if (!ValidateWord(lo) || !ValidateWord(hi) || lo > hi) {
+        return 0;
+    }
+
+    // Words before hi, plus hi itself, minus the words before lo
+    int count = Rank(hi) - Rank(lo);
+
+    // FindWord rather than Search, so a range count doesn't show up in a trace as a lookup of hi
+    if (FindWord(hi, false)) {
+        count++;
+    }
+
+    return count;
+}
+
+vector<string> Trie::Range(const string& lo, const string& hi) {
+    vector<string> words;
+
+    if (!ValidateWord(lo) || !ValidateWord(hi) || lo > hi) {
+        return words;
+    }
+
+    RecursiveRange(words, GetRoot().get(), "", lo, hi);
+
+    return words;
+}
+
+void Trie::RecursiveRange(vector<string>& words, trie_node* cursor, string word, const string& lo, const string& hi) {
+    // Every word below the cursor starts with the cursor's word, so if it's already past hi
+    // then so is everything below it
+    if (word > hi) {
+        return;
+    }
+
+    // Same for words before lo, unless the cursor's word is a prefix of lo, in which case
+    // some of the longer words below it might still be in range
+    if (word < lo && lo.compare(0, word.length(), word) != 0) {
+        return;
+    }
+
+    if (cursor->is_end_of_word && word >= lo) {
+        words.push_back(word);
+    }
+
+    for (auto child : cursor->children) {
+        if (child) {
+            RecursiveRange(words, child.get(), word + child->letter, lo, hi);
+        }
+    }
 }
 
 void Trie::Print() {
@@ -285,15 +771,336 @@ void Trie::RecursiveGetAllWords(vector<string>& words, shared_ptr<trie_node> cur
     }
 }
 
+void Trie::Merge(const Trie& other) {
+    bool parallel = IsWorthParallelizing(other);
+
+    RecursiveMerge(GetRoot().get(), other.root.get(), false, parallel);
+    matcher_compiled = false;
+}
+
+void Trie::Merge(Trie&& other) {
+    // Merging a trie into itself doesn't change anything, and moving would empty it
+    if (&other == this) { return; }
+
+    bool parallel = IsWorthParallelizing(other);
+
+    RecursiveMerge(GetRoot().get(), other.root.get(), true, parallel);
+    matcher_compiled = false;
+
+    // Some of the other trie's nodes now belong to this one, so give it a fresh empty root
+    other.SetRoot(InitTrieNode('\0'));
+    other.matcher_compiled = false;
+}
+
+void Trie::Intersect(const Trie& other) {
+    bool parallel = IsWorthParallelizing(other);
+
+    RecursiveIntersect(GetRoot().get(), other.root.get(), parallel);
+    matcher_compiled = false;
+}
+
+void Trie::Difference(const Trie& other) {
+    bool parallel = IsWorthParallelizing(other);
+
+    RecursiveDifference(GetRoot().get(), other.root.get(), parallel);
+    matcher_compiled = false;
+}
+
+bool Trie::IsWorthParallelizing(const Trie& other) {
+    // With a single core the threads would only take turns, so starting them is never paid back
+    if (thread::hardware_concurrency() < 2) {
+        return false;
+    }
+
+    return Size() + other.root->word_count >= PARALLEL_SET_OPERATION_MIN_WORDS;
+}
+
+int Trie::RecursiveMerge(trie_node* node, trie_node* other_node, bool move_subtrees, bool parallel) {
+    node->is_end_of_word = node->is_end_of_word || other_node->is_end_of_word;
+
+    ForEachChildIndex(node, other_node, [&](int i) {
+        shared_ptr<trie_node>& other_child = other_node->children.at(i);
+        shared_ptr<trie_node>& child = node->children.at(i);
+
+        // Nothing to add from the other trie under this letter
+        if (!other_child) {
+            return;
+        }
+
+        // Only the other trie has this letter, so the whole subtree can be taken as it is
+        if (!child) {
+            if (move_subtrees) {
+                child = move(other_child);
+
+                // Visits traced on the other trie don't belong in this trie's trace
+                ClearVisits(child.get());
+            }
+            else {
+                child = CloneSubtree(other_child.get());
+            }
+        }
+        // Both tries have the letter, so keep walking them together
+        else {
+            RecursiveMerge(child.get(), other_child.get(), move_subtrees, false);
+        }
+    }, parallel);
+
+    return RecountWords(node);
+}
+
+int Trie::RecursiveIntersect(trie_node* node, trie_node* other_node, bool parallel) {
+    node->is_end_of_word = node->is_end_of_word && other_node->is_end_of_word;
+
+    ForEachChildIndex(node, other_node, [&](int i) {
+        shared_ptr<trie_node>& child = node->children.at(i);
+
+        if (!child) {
+            return;
+        }
+
+        // If the other trie doesn't have the letter, or none of the words below it are
+        // in both tries, the whole subtree goes
+        if (!other_node->children.at(i) || RecursiveIntersect(child.get(), other_node->children.at(i).get(), false) == 0) {
+            child = shared_ptr<trie_node>(NULL);
+        }
+    }, parallel);
+
+    return RecountWords(node);
+}
+
+int Trie::RecursiveDifference(trie_node* node, trie_node* other_node, bool parallel) {
+    if (other_node->is_end_of_word) {
+        node->is_end_of_word = false;
+    }
+
+    ForEachChildIndex(node, other_node, [&](int i) {
+        shared_ptr<trie_node>& child = node->children.at(i);
+
+        // Only letters both tries have can have words to take away
+        if (!child || !other_node->children.at(i)) {
+            return;
+        }
+
+        // If every word below the letter was taken away, the whole subtree goes
+        if (RecursiveDifference(child.get(), other_node->children.at(i).get(), false) == 0) {
+            child = shared_ptr<trie_node>(NULL);
+        }
+    }, parallel);
+
+    return RecountWords(node);
+}
+
+void Trie::ForEachChildIndex(trie_node* node, trie_node* other_node, function<void(int)> visit, bool parallel) {
+    // Only letters that at least one of the tries has can have any work to do
+    vector<int> indexes;
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        if (node->children.at(i) || other_node->children.at(i)) {
+            indexes.push_back(i);
+        }
+    }
+
+    // Each thread only touches its own child slot and the nodes below it, so they don't get in each other's way
+    vector<thread> threads;
+    size_t next = 0;
+
+    if (parallel && indexes.size() > 1) {
+        try {
+            // The last branch runs on this thread instead of waiting idle
+            for (; next + 1 < indexes.size(); next++) {
+                threads.push_back(thread(visit, indexes.at(next)));
+            }
+        }
+        catch (const system_error&) {
+            // If no more threads can be started, the branches that are left run here instead
+        }
+    }
+
+    for (; next < indexes.size(); next++) {
+        visit(indexes.at(next));
+    }
+
+    for (auto& branch_thread : threads) {
+        branch_thread.join();
+    }
+}
+
+int Trie::RecountWords(trie_node* node) {
+    node->word_count = node->is_end_of_word ? 1 : 0;
+
+    for (auto child : node->children) {
+        if (child) {
+            node->word_count += child->word_count;
+        }
+    }
+
+    return node->word_count;
+}
+
+shared_ptr<trie_node> Trie::CopyNode(trie_node* node) {
+    shared_ptr<trie_node> copy = InitTrieNode(node->letter);
+
+    copy->is_end_of_word = node->is_end_of_word;
+    copy->word_count = node->word_count;
+    copy->visits = node->visits.load();
+
+    return copy;
+}
+
+shared_ptr<trie_node> Trie::CloneSubtree(trie_node* node) {
+    shared_ptr<trie_node> copy = CopyNode(node);
+
+    // Visits recorded in the other trie don't say anything about traffic on this one
+    copy->visits = 0;
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        if (node->children.at(i)) {
+            copy->children.at(i) = CloneSubtree(node->children.at(i).get());
+        }
+    }
+
+    return copy;
+}
+
+int Trie::Compact() {
+    // Each pair is a node from the old trie and the copy of it in the new one
+    queue<pair<trie_node*, shared_ptr<trie_node>>> nodes;
+    shared_ptr<trie_node> new_root = CopyNode(GetRoot().get());
+    int moved = 1;
+
+    nodes.push(make_pair(GetRoot().get(), new_root));
+
+    // Copy the trie one level at a time. All the children of a node are allocated one after
+    // another, so siblings and then whole levels end up next to each other on the heap
+    // instead of wherever the original inserts happened to put them.
+    while (!nodes.empty()) {
+        trie_node* old_node = nodes.front().first;
+        shared_ptr<trie_node> new_node = nodes.front().second;
+        nodes.pop();
+
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            trie_node* old_child = old_node->children.at(i).get();
+
+            if (!old_child) {
+                continue;
+            }
+
+            shared_ptr<trie_node> new_child = CopyNode(old_child);
+
+            new_node->children.at(i) = new_child;
+            nodes.push(make_pair(old_child, new_child));
+            moved++;
+        }
+    }
+
+    // The old nodes are freed once nothing else holds on to them.
+    // The matcher's links point into the old nodes, so they need to be rebuilt.
+    SetRoot(new_root);
+    matcher_compiled = false;
+
+    return moved;
+}
+
+void Trie::StartTrace() {
+    ClearVisits(GetRoot().get());
+    tracing = true;
+}
+
+void Trie::StopTrace() {
+    tracing = false;
+}
+
+void Trie::RecordVisit(trie_node* node) {
+    // Only the final count matters, so the increments don't need to be ordered with anything else
+    node->visits.fetch_add(1, memory_order_relaxed);
+}
+
+void Trie::ClearVisits(trie_node* node) {
+    node->visits = 0;
+
+    for (auto child : node->children) {
+        if (child) {
+            ClearVisits(child.get());
+        }
+    }
+}
+
+// A node waiting to be copied, along with the slot its copy goes into
+struct relayout_entry {
+    unsigned int visits;
+    int order;              // when the node was found, so that ties are broken depth first
+    trie_node* old_node;
+    shared_ptr<trie_node>* new_slot;
+};
+
+int Trie::RelayoutByTrace() {
+    // Always copy the most visited node that's waiting next. A node only starts waiting once its
+    // parent has been copied, so hot paths are laid out from the root down, one after another,
+    // and nodes that were never visited all come last.
+    //
+    // Among nodes visited equally often, the one found last goes first, which lays them out depth
+    // first. A word's nodes then sit one after another, and so does a subtree that suggestions
+    // walk as a whole. Breadth first would spread both over every level of the trie.
+    auto colder = [](const relayout_entry& a, const relayout_entry& b) {
+        if (a.visits != b.visits) {
+            return a.visits < b.visits;
+        }
+
+        return a.order < b.order;
+    };
+
+    priority_queue<relayout_entry, vector<relayout_entry>, decltype(colder)> nodes(colder);
+    shared_ptr<trie_node> new_root = CopyNode(GetRoot().get());
+    int moved = 1;
+    int order = 0;
+
+    trie_node* old_parent = GetRoot().get();
+    trie_node* new_parent = new_root.get();
+
+    while (true) {
+        // Children of the node that was just copied start waiting. They're found from the
+        // last letter back, so that ties are copied in alphabetical order.
+        for (int i = ALPHABET_SIZE - 1; i >= 0; i--) {
+            trie_node* old_child = old_parent->children.at(i).get();
+
+            if (old_child) {
+                relayout_entry entry = { old_child->visits.load(), order++, old_child, &new_parent->children.at(i) };
+                nodes.push(entry);
+            }
+        }
+
+        if (nodes.empty()) {
+            break;
+        }
+
+        relayout_entry next = nodes.top();
+        nodes.pop();
+
+        *next.new_slot = CopyNode(next.old_node);
+        old_parent = next.old_node;
+        new_parent = next.new_slot->get();
+        moved++;
+    }
+
+    // Same as Compact, the old nodes are freed once nothing else holds on to them
+    SetRoot(new_root);
+    matcher_compiled = false;
+
+    return moved;
+}
+
 shared_ptr<trie_node> Trie::GetRoot() {
     return root;
 }
 
 shared_ptr<trie_node> Trie::InitTrieNode(char letter) {
-    shared_ptr<trie_node> new_node (new trie_node);
+    // make_shared puts the node and its reference count in a single allocation
+    shared_ptr<trie_node> new_node = make_shared<trie_node>();
 
     new_node->is_end_of_word = false;
     new_node->letter = letter;
+    new_node->word_count = 0;
+    new_node->visits = 0;
     new_node->children = vector<shared_ptr<trie_node>>(ALPHABET_SIZE);
 
     // Make sure all the child nodes are itialized to null
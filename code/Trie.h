@@ -5,15 +5,54 @@
 #include <memory>
 #include <string>
 #include <iostream>
+#include <functional>
+#include <atomic>
 
 using namespace std;
 
 const int ALPHABET_SIZE = 26;
 
+// Merge, Intersect and Difference work on the root's branches in parallel once the two tries
+// hold at least this many words between them, if there's more than one core. `run_bench setops`
+// measured about 0.9ms to start and join 25 threads and 0.2-0.3us of merging per word, so two
+// cores start to come out ahead at 6000-8000 words. This is rounded up to leave some margin.
+const int PARALLEL_SET_OPERATION_MIN_WORDS = 10000;
+
 struct trie_node {
     bool is_end_of_word;
     vector<shared_ptr<trie_node>> children;
     char letter;
+    int word_count;     // how many words end at this node or below it
+    atomic<unsigned int> visits;    // how many times Search or SuggestionsForPrefix passed through this node while tracing
+};
+
+// Columns of the matcher's transition table: one per letter, and one for everything else
+const int MATCHER_COLUMNS = ALPHABET_SIZE + 1;
+
+// Multi-pattern matcher (Aho–Corasick) built from the trie by CompileMatcher. Its states are
+// the trie's nodes numbered breadth first, with 0 for the root. Every transition, failure
+// links included, is worked out ahead of time and kept in one flat table, so scanning a
+// character is a single lookup instead of a walk through the nodes.
+struct compiled_matcher {
+    vector<int> next;           // next[state * MATCHER_COLUMNS + column] is the state after reading a character in that column
+    vector<int> depth;          // length of the word each state stands for
+    vector<int> match;          // longest word that ends at this state (the state itself or one along its failure links), or -1
+    vector<int> next_match;     // for a state that is the end of a word, the next shorter word that ends with it, or -1
+};
+
+// Text a chunked Tokenize is holding on to, because the longest word starting there might
+// continue into the next chunk. A default constructed state starts a new text.
+struct tokenize_state {
+    string pending;
+};
+
+// Where a chunked scan is up to, so that matches spanning chunk boundaries are still found.
+// A default constructed state starts a new scan.
+struct scan_state {
+    int state = 0;              // matcher state the scan stopped in
+    size_t offset = 0;          // how many characters have been scanned so far
+    string tail;                // the last few characters scanned, enough to rebuild a match that started in an earlier chunk
+    unsigned long version = 0;  // which compile of the matcher the state belongs to
 };
 
 class Trie {
@@ -37,20 +76,125 @@ class Trie {
         // If there are no possible words, an empty vector is returned.
         vector<string> SuggestionsForPrefix(string prefix);
 
+        // Searches for several words at once and returns whether each one was found, in the same
+        // order as the words. Each walk starts from the deepest node the word shares with the word
+        // before it, so sorting the words first lets neighbours skip most of their walks.
+        vector<bool> SearchMany(const vector<string>& words);
+
+        // Returns the suggestions for several prefixes at once, in the same order as the prefixes.
+        // Walks are shared between neighbouring prefixes the same way as in SearchMany.
+        vector<vector<string>> SuggestionsForPrefixes(const vector<string>& prefixes);
+
         // Returns how many words are in the trie
         int Size();
 
+        // Validates the word only contains lowercase letters and no special characters,
+        // which is what Insert accepts
+        bool ValidateWord(const string& word);
+
+        // Returns how many words in the trie come before the given word in alphabetical order.
+        // The word doesn't have to be in the trie. Returns -1 for an invalid word.
+        int Rank(const string& word);
+
+        // Returns the word at the given position (starting at 0) in alphabetical order.
+        // If the position is out of range, an empty string is returned.
+        string Select(int index);
+
+        // Returns how many words are between lo and hi in alphabetical order, including lo and hi
+        int CountRange(const string& lo, const string& hi);
+
+        // Returns the words between lo and hi (including lo and hi) in alphabetical order.
+        // Only the part of the trie inside the range is visited.
+        vector<string> Range(const string& lo, const string& hi);
+
         // Prints all words in the trie in alphabetical order
         void Print();
 
         // Retuns a list of all words in the trie in alphabetical order
         vector<string> GetAllWords();
 
+        // Returns the longest word in the trie that is a prefix of the given text.
+        // If no word is a prefix of the text, an empty string is returned.
+        string LongestPrefixOf(const string& text);
+
+        // Calls the callback with every word in the trie that is a prefix of the given text,
+        // shortest first. Only one walk down the trie is made.
+        void AllPrefixesOf(const string& text, function<void(const string&)> callback);
+
+        // Splits the text into words from the trie, always taking the longest word that matches
+        // at the current position. Characters that don't start any word are skipped. Each position
+        // starts a new walk from the root, so in the worst case this costs the length of the text
+        // times the length of the longest word.
+        vector<string> Tokenize(const string& text);
+
+        // Same as Tokenize, but for text that arrives in pieces. Pass the same state for each
+        // chunk and call TokenizeFinish after the last one. Tokens are passed to the callback as
+        // soon as no more text could make them longer.
+        void TokenizeChunk(tokenize_state& state, const string& chunk, function<void(const string&)> callback);
+
+        // Passes on the tokens still held back in the state and resets it for a new text
+        void TokenizeFinish(tokenize_state& state, function<void(const string&)> callback);
+
+        // Builds the matcher that lets every word in the trie be found in a single pass over
+        // a text. Called automatically by ScanAll and ScanChunk
+        // when the trie has changed since the last compile.
+        void CompileMatcher();
+
+        // Calls the callback for every occurrence of a word from the trie in the text,
+        // with the position the occurrence starts at. Overlapping matches are all reported.
+        void ScanAll(const string& text, function<void(const string&, size_t)> callback);
+
+        // Same as ScanAll, but for text that arrives in pieces. Pass the same state for each
+        // chunk; positions are counted from the start of the first chunk.
+        // If the trie is changed between chunks, the scan starts over from the next chunk.
+        void ScanChunk(scan_state& state, const string& chunk, function<void(const string&, size_t)> callback);
+
+        // Adds all the words from the other trie. Parts of the other trie that this trie
+        // doesn't have are copied over whole.
+        void Merge(const Trie& other);
+
+        // Same as above, but the parts of the other trie that this trie doesn't have are moved
+        // over instead of copied. The other trie is left empty.
+        void Merge(Trie&& other);
+
+        // Removes all the words that aren't also in the other trie
+        void Intersect(const Trie& other);
+
+        // Removes all the words that are in the other trie
+        void Difference(const Trie& other);
+
+        // Rebuilds the trie's nodes in breadth-first order so that nodes near each other in
+        // the trie are also near each other in memory. Worth calling after a lot of removals.
+        // Returns the number of nodes that were moved.
+        int Compact();
+
+        // Starts counting how often Search and SuggestionsForPrefix (and SearchMany and
+        // SuggestionsForPrefixes) visit each node, clearing any earlier counts. The counts are
+        // atomic, so lookups can keep running on several threads at once while tracing, but
+        // StartTrace, StopTrace and RelayoutByTrace need the trie to themselves.
+        void StartTrace();
+
+        // Stops counting node visits. The counts are kept for RelayoutByTrace.
+        void StopTrace();
+
+        // Rebuilds the trie's nodes so that the most visited ones are allocated first, next to
+        // each other, with nodes that were never visited placed after all of them. Nodes visited
+        // equally often are laid out depth first. Returns the number of nodes that were moved.
+        int RelayoutByTrace();
+
         // Returns the root node
         shared_ptr<trie_node> GetRoot();
         
     private:
         shared_ptr<trie_node> root;
+
+        // Whether node visits are being counted
+        bool tracing;
+
+        // Whether the matcher is up to date with the words in the trie
+        compiled_matcher matcher;
+        bool matcher_compiled;
+        unsigned long matcher_version;
         shared_ptr<trie_node> InitTrieNode(char letter);
 
         // Sets the root of the trie
@@ -62,8 +206,6 @@ class Trie {
         // Returns the index of the given character
         int LetterIndex(char letter);
 
-        // Validates the word only contains lowercase letters and no special characters
-        bool ValidateWord(const string& word);
 
         // Recursive helper for insert
         void RecursiveInsert(shared_ptr<trie_node>& node, const string& word, int current_letter_index);
@@ -77,9 +219,64 @@ class Trie {
         // Get all the direct child letters of a node
         vector<shared_ptr<trie_node>> GetChildLetters(shared_ptr<trie_node> node);
 
+        // Walks down to the node for the word, starting from the deepest node it shares with the
+        // previous walk. path holds the child slots the previous walk went through (the first one
+        // is the root), and previous is the word it was for. Both are updated for the next walk.
+        // Returns null if the word isn't in the trie.
+        const shared_ptr<trie_node>* FindNodeFrom(vector<const shared_ptr<trie_node>*>& path, string& previous, const string& word);
+
         // Returns a pointer to the last letter node of a prefix
         shared_ptr<trie_node> FindEndOfPrefix(string prefix);
 
+        // Search, but only counts node visits when record_visits is true. Insert and Remove use this
+        // so that their existence checks don't show up in the trace.
+        bool FindWord(const string& word, bool record_visits);
+
+        // Returns the length of the longest word that starts at the given position in the text,
+        // or 0 if no word starts there
+        size_t LongestPrefixLength(const string& text, size_t start);
+
+        // Same as above, and sets reached_end if the walk was still going when the text ran out,
+        // meaning more text could have given a longer word
+        size_t LongestPrefixLength(const string& text, size_t start, bool& reached_end);
+
+        // Splits as much of the text into tokens as it can, passing each to the callback.
+        // Unless final is true, it stops at the first position whose token could depend on
+        // text that hasn't arrived yet. Returns how many characters were used up.
+        size_t TokenizeBuffer(const string& text, bool final, function<void(const string&)> callback);
+
+        // Recursive helper for finding the words in a range
+        void RecursiveRange(vector<string>& words, trie_node* cursor, string word, const string& lo, const string& hi);
+
+        // Whether a set operation with the other trie should work on the root's branches in parallel
+        bool IsWorthParallelizing(const Trie& other);
+
+        // Recursive helpers for the set operations. Each one walks both tries' children together
+        // and returns the node's new word count. When parallel is true, each child is handled
+        // on its own thread.
+        int RecursiveMerge(trie_node* node, trie_node* other_node, bool move_subtrees, bool parallel);
+        int RecursiveIntersect(trie_node* node, trie_node* other_node, bool parallel);
+        int RecursiveDifference(trie_node* node, trie_node* other_node, bool parallel);
+
+        // Calls visit with the index of each child slot that is filled in either node, either one after
+        // another or each on its own thread. If threads can't be started, the rest run on the calling thread.
+        void ForEachChildIndex(trie_node* node, trie_node* other_node, function<void(int)> visit, bool parallel);
+
+        // Recalculates a node's word count from its own flag and its children's counts
+        int RecountWords(trie_node* node);
+
+        // Returns a new node with the same letter, flags and counts as the given node, but no children
+        shared_ptr<trie_node> CopyNode(trie_node* node);
+
+        // Adds one to the node's visit count
+        void RecordVisit(trie_node* node);
+
+        // Sets every node's visit count back to 0
+        void ClearVisits(trie_node* node);
+
+        // Returns a copy of the given node and everything below it, with no recorded visits
+        shared_ptr<trie_node> CloneSubtree(trie_node* node);
+
         // Recursive helper for finding suggestions
         void RecursiveSuggestionsForPrefix(vector<string>& suggestions, shared_ptr<trie_node> prefix_last_letter, string prefix);
 };
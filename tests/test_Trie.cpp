@@ -4,6 +4,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <thread>
 
 using namespace std;
 
@@ -32,6 +33,22 @@ int letter_index(char letter) {
 	return letter - 'a';
 }
 
+// Inserts every three letter word whose last letter is between 'a' and last_letter
+void insert_three_letter_words(Trie& trie, char last_letter) {
+	string word = "aaa";
+
+	for (char first = 'a'; first <= 'z'; first++) {
+		for (char second = 'a'; second <= 'z'; second++) {
+			for (char third = 'a'; third <= last_letter; third++) {
+				word[0] = first;
+				word[1] = second;
+				word[2] = third;
+				trie.Insert(word);
+			}
+		}
+	}
+}
+
 /////////////////////////////////////////
 // Tests start here
 
@@ -254,3 +271,547 @@ TEST_F(test_Trie, TestSize) {
 
 	ASSERT_EQ(trie.Size(), 5);
 }
+
+TEST_F(test_Trie, TestSearchMany) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("catsup");
+	trie.Insert("dog");
+
+	// Sorted, unsorted, missing, partly matching and invalid words should all agree with Search
+	vector<string> words = { "ca", "cat", "catch", "cats", "catsup", "catsupper", "dog", "cat", "", "Dog", "do", "zebra", };
+	vector<bool> found = trie.SearchMany(words);
+	ASSERT_EQ(found.size(), words.size());
+
+	for (size_t i = 0; i < words.size(); i++) {
+		ASSERT_EQ(found.at(i), trie.Search(words.at(i))) << words.at(i);
+	}
+
+	ASSERT_EQ(trie.SearchMany(vector<string>()).size(), 0);
+}
+
+TEST_F(test_Trie, TestSuggestionsForPrefixes) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("catsup");
+	trie.Insert("catch");
+	trie.Insert("dogs");
+
+	vector<string> prefixes = { "c", "ca", "catc", "cats", "catz", "d", "ca", "", "--", };
+	vector<vector<string>> suggestions = trie.SuggestionsForPrefixes(prefixes);
+	ASSERT_EQ(suggestions.size(), prefixes.size());
+
+	for (size_t i = 0; i < prefixes.size(); i++) {
+		ASSERT_EQ(suggestions.at(i), trie.SuggestionsForPrefix(prefixes.at(i))) << prefixes.at(i);
+	}
+}
+
+TEST_F(test_Trie, TestLongestPrefixOf) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("catsup");
+
+	ASSERT_EQ(trie.LongestPrefixOf("catsuppy"), "catsup");
+	ASSERT_EQ(trie.LongestPrefixOf("catsu"), "cats");
+	ASSERT_EQ(trie.LongestPrefixOf("cat"), "cat");
+
+	// Stops at characters that can't be in the trie
+	ASSERT_EQ(trie.LongestPrefixOf("cats/home"), "cats");
+
+	// No word is a prefix
+	ASSERT_EQ(trie.LongestPrefixOf("ca"), "");
+	ASSERT_EQ(trie.LongestPrefixOf("dog"), "");
+	ASSERT_EQ(trie.LongestPrefixOf(""), "");
+}
+
+TEST_F(test_Trie, TestAllPrefixesOf) {
+	vector<string> prefixes;
+	vector<string> expected;
+	Trie trie;
+	trie.Insert("a");
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("catsup");
+	trie.Insert("dog");
+
+	trie.AllPrefixesOf("catsuppy", [&prefixes](const string& word) { prefixes.push_back(word); });
+	expected = vector<string> { "cat", "cats", "catsup", };
+	ASSERT_EQ(prefixes, expected);
+
+	prefixes.clear();
+	trie.AllPrefixesOf("do", [&prefixes](const string& word) { prefixes.push_back(word); });
+	ASSERT_EQ(prefixes.size(), 0);
+}
+
+TEST_F(test_Trie, TestTokenize) {
+	vector<string> tokens;
+	vector<string> expected;
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("up");
+	trie.Insert("dog");
+
+	// Longest match wins, so "cats" is taken over "cat"
+	tokens = trie.Tokenize("catsupdog");
+	expected = vector<string> { "cats", "up", "dog", };
+	ASSERT_EQ(tokens, expected);
+
+	// Characters that don't start a word are skipped
+	tokens = trie.Tokenize("xcat--dogz");
+	expected = vector<string> { "cat", "dog", };
+	ASSERT_EQ(tokens, expected);
+
+	tokens = trie.Tokenize("");
+	ASSERT_EQ(tokens.size(), 0);
+}
+
+TEST_F(test_Trie, TestTokenizeChunk) {
+	vector<string> tokens;
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("catsup");
+	trie.Insert("up");
+	trie.Insert("dog");
+
+	auto record = [&tokens](const string& token) { tokens.push_back(token); };
+	string text = "catsupdog cats-up catsu catdog";
+	vector<string> expected = trie.Tokenize(text);
+
+	// Splitting the text anywhere gives the same tokens, including inside a word that could still grow
+	for (size_t split = 0; split <= text.length(); split++) {
+		tokens.clear();
+		tokenize_state state;
+		trie.TokenizeChunk(state, text.substr(0, split), record);
+		trie.TokenizeChunk(state, text.substr(split), record);
+		trie.TokenizeFinish(state, record);
+		ASSERT_EQ(tokens, expected) << split;
+	}
+
+	// "cats" can't be settled until it's known whether "catsup" follows
+	tokens.clear();
+	tokenize_state state;
+	trie.TokenizeChunk(state, "dogcats", record);
+	ASSERT_EQ(tokens, (vector<string> { "dog", }));
+	trie.TokenizeChunk(state, "u", record);
+	ASSERT_EQ(tokens, (vector<string> { "dog", }));
+	trie.TokenizeChunk(state, "p", record);
+	trie.TokenizeFinish(state, record);
+	ASSERT_EQ(tokens, (vector<string> { "dog", "catsup", }));
+}
+
+TEST_F(test_Trie, TestScanAll) {
+	vector<pair<string, size_t>> matches;
+	vector<pair<string, size_t>> expected;
+	Trie trie;
+	trie.Insert("he");
+	trie.Insert("she");
+	trie.Insert("his");
+	trie.Insert("hers");
+
+	auto record = [&matches](const string& word, size_t position) { matches.push_back(make_pair(word, position)); };
+
+	// Overlapping matches are all reported
+	trie.ScanAll("ushers", record);
+	expected = vector<pair<string, size_t>> { make_pair("she", 1), make_pair("he", 2), make_pair("hers", 2), };
+	ASSERT_EQ(matches, expected);
+
+	// Characters that aren't lowercase letters break up matches
+	matches.clear();
+	trie.ScanAll("h-e his", record);
+	expected = vector<pair<string, size_t>> { make_pair("his", 4), };
+	ASSERT_EQ(matches, expected);
+
+	// Words inserted after a scan are picked up by the next scan
+	trie.Insert("us");
+	matches.clear();
+	trie.ScanAll("us", record);
+	expected = vector<pair<string, size_t>> { make_pair("us", 0), };
+	ASSERT_EQ(matches, expected);
+}
+
+TEST_F(test_Trie, TestScanChunk) {
+	vector<pair<string, size_t>> matches;
+	vector<pair<string, size_t>> expected;
+	Trie trie;
+	trie.Insert("he");
+	trie.Insert("she");
+	trie.Insert("his");
+	trie.Insert("hers");
+
+	auto record = [&matches](const string& word, size_t position) { matches.push_back(make_pair(word, position)); };
+
+	trie.ScanAll("ushers and this", record);
+	expected = matches;
+
+	// Splitting the text into chunks shouldn't change the matches, even when they span chunks
+	matches.clear();
+	scan_state state;
+	trie.ScanChunk(state, "us", record);
+	trie.ScanChunk(state, "h", record);
+	trie.ScanChunk(state, "ers and t", record);
+	trie.ScanChunk(state, "hi", record);
+	trie.ScanChunk(state, "s", record);
+	ASSERT_EQ(matches, expected);
+}
+
+TEST_F(test_Trie, TestRankAndSelect) {
+	Trie trie;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("bark");
+	trie.Insert("applesauce");
+	trie.Insert("catepillar");
+	trie.Insert("zebra");
+
+	vector<string> words = trie.GetAllWords();
+
+	// Rank and Select should agree with the position in the alphabetical list
+	for (int i = 0; i < (int)words.size(); i++) {
+		ASSERT_EQ(trie.Rank(words.at(i)), i);
+		ASSERT_EQ(trie.Select(i), words.at(i));
+	}
+
+	// Words that aren't in the trie are ranked by where they would go
+	ASSERT_EQ(trie.Rank("a"), 0);
+	ASSERT_EQ(trie.Rank("applesauces"), 2);
+	ASSERT_EQ(trie.Rank("car"), 3);
+	ASSERT_EQ(trie.Rank("zzz"), 6);
+	ASSERT_EQ(trie.Rank("Cat"), -1);
+
+	// Out of range positions
+	ASSERT_EQ(trie.Select(-1), "");
+	ASSERT_EQ(trie.Select(6), "");
+
+	// Counts are kept up to date through removal and duplicate inserts
+	trie.Remove("bark");
+	trie.Insert("apple");
+	ASSERT_EQ(trie.Rank("cat"), 2);
+	ASSERT_EQ(trie.Select(2), "cat");
+	ASSERT_EQ(trie.Size(), 5);
+}
+
+TEST_F(test_Trie, TestRange) {
+	vector<string> words;
+	vector<string> expected;
+	Trie trie;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("bark");
+	trie.Insert("applesauce");
+	trie.Insert("catepillar");
+	trie.Insert("zebra");
+
+	// Both ends are included
+	words = trie.Range("applesauce", "cat");
+	expected = vector<string> { "applesauce", "bark", "cat", };
+	ASSERT_EQ(words, expected);
+	ASSERT_EQ(trie.CountRange("applesauce", "cat"), 3);
+
+	// Ends don't have to be words in the trie
+	words = trie.Range("applf", "catz");
+	expected = vector<string> { "bark", "cat", "catepillar", };
+	ASSERT_EQ(words, expected);
+	ASSERT_EQ(trie.CountRange("applf", "catz"), 3);
+
+	words = trie.Range("a", "zz");
+	ASSERT_EQ(words, trie.GetAllWords());
+	ASSERT_EQ(trie.CountRange("a", "zz"), 6);
+
+	// Empty and backwards ranges
+	ASSERT_EQ(trie.Range("d", "y").size(), 0);
+	ASSERT_EQ(trie.CountRange("d", "y"), 0);
+	ASSERT_EQ(trie.Range("zebra", "apple").size(), 0);
+	ASSERT_EQ(trie.CountRange("zebra", "apple"), 0);
+}
+
+TEST_F(test_Trie, TestCompact) {
+	Trie trie;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("bark");
+	trie.Insert("applesauce");
+	trie.Insert("catepillar");
+	trie.Insert("zebra");
+	trie.Remove("catepillar");
+	trie.Remove("bark");
+
+	vector<string> words = trie.GetAllWords();
+	shared_ptr<trie_node> old_root = trie.GetRoot();
+
+	// root + "apple" + "sauce" + "cat" + "zebra"
+	ASSERT_EQ(trie.Compact(), 1 + 5 + 5 + 3 + 5);
+
+	// The nodes are new, but the words and counts are the same
+	ASSERT_NE(trie.GetRoot(), old_root);
+	ASSERT_EQ(trie.GetAllWords(), words);
+	ASSERT_EQ(trie.Size(), 4);
+	ASSERT_EQ(trie.Rank("cat"), 2);
+	ASSERT_TRUE(trie.Search("applesauce"));
+	ASSERT_FALSE(trie.Search("bark"));
+
+	// The compacted trie can still be changed and scanned
+	trie.Insert("bark");
+	trie.Remove("apple");
+	vector<string> matches;
+	trie.ScanAll("barking applesauce", [&matches](const string& word, size_t position) { matches.push_back(word); });
+	ASSERT_EQ(matches, (vector<string> { "bark", "applesauce", }));
+}
+
+TEST_F(test_Trie, TestMerge) {
+	vector<string> expected;
+	Trie trie;
+	Trie other;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	other.Insert("cats");
+	other.Insert("apple");
+	other.Insert("zebra");
+
+	trie.Merge(other);
+	expected = vector<string> { "apple", "cat", "cats", "zebra", };
+	ASSERT_EQ(trie.GetAllWords(), expected);
+	ASSERT_EQ(trie.Size(), 4);
+	ASSERT_EQ(trie.Rank("zebra"), 3);
+
+	// Visits traced on the other trie aren't copied over
+	Trie traced;
+	traced.Insert("dog");
+	traced.StartTrace();
+	traced.Search("dog");
+	traced.StopTrace();
+	trie.Merge(traced);
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('d'))->visits.load(), 0);
+	trie.Remove("dog");
+
+	// The other trie is unchanged, and doesn't share nodes with this one
+	trie.Remove("zebra");
+	ASSERT_EQ(other.Size(), 3);
+	ASSERT_TRUE(other.Search("zebra"));
+
+	// Moving merge leaves the other trie empty
+	Trie overlay;
+	overlay.Insert("dog");
+	overlay.Insert("catsup");
+	overlay.StartTrace();
+	overlay.Search("dog");
+	overlay.StopTrace();
+	trie.Merge(move(overlay));
+	expected = vector<string> { "apple", "cat", "cats", "catsup", "dog", };
+	ASSERT_EQ(trie.GetAllWords(), expected);
+	ASSERT_EQ(overlay.Size(), 0);
+	ASSERT_EQ(overlay.GetAllWords().size(), 0);
+
+	// Visits traced on the other trie don't come along with the subtrees that are moved over either
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('d'))->visits.load(), 0);
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('d'))->children.at(letter_index('o'))->visits.load(), 0);
+}
+
+TEST_F(test_Trie, TestIntersect) {
+	vector<string> expected;
+	Trie trie;
+	Trie other;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("zebra");
+	other.Insert("cats");
+	other.Insert("apples");
+	other.Insert("zebra");
+
+	trie.Intersect(other);
+	expected = vector<string> { "cats", "zebra", };
+	ASSERT_EQ(trie.GetAllWords(), expected);
+	ASSERT_EQ(trie.Size(), 2);
+
+	// Branches with no words left are removed
+	ASSERT_FALSE(trie.GetRoot()->children.at(letter_index('a')));
+}
+
+TEST_F(test_Trie, TestDifference) {
+	vector<string> expected;
+	Trie trie;
+	Trie blocklist;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("zebra");
+	blocklist.Insert("cat");
+	blocklist.Insert("zebra");
+	blocklist.Insert("dog");
+
+	trie.Difference(blocklist);
+	expected = vector<string> { "apple", "cats", };
+	ASSERT_EQ(trie.GetAllWords(), expected);
+	ASSERT_EQ(trie.Size(), 2);
+	ASSERT_FALSE(trie.GetRoot()->children.at(letter_index('z')));
+}
+
+TEST_F(test_Trie, TestSetOperationsInParallel) {
+	// Big enough that, with more than one core, the root's branches are handled on separate threads
+	Trie all_words;
+	Trie some_words;
+	insert_three_letter_words(all_words, 'z');
+	insert_three_letter_words(some_words, 'm');
+	ASSERT_GE(all_words.Size() + some_words.Size(), PARALLEL_SET_OPERATION_MIN_WORDS);
+
+	Trie merged;
+	insert_three_letter_words(merged, 'm');
+	merged.Merge(all_words);
+	ASSERT_EQ(merged.Size(), 26 * 26 * 26);
+	ASSERT_EQ(merged.GetAllWords(), all_words.GetAllWords());
+
+	Trie intersected;
+	insert_three_letter_words(intersected, 'z');
+	intersected.Intersect(some_words);
+	ASSERT_EQ(intersected.Size(), 26 * 26 * 13);
+	ASSERT_EQ(intersected.GetAllWords(), some_words.GetAllWords());
+
+	Trie difference;
+	insert_three_letter_words(difference, 'z');
+	difference.Difference(some_words);
+	ASSERT_EQ(difference.Size(), 26 * 26 * 13);
+	ASSERT_TRUE(difference.Search("abz"));
+	ASSERT_FALSE(difference.Search("abm"));
+}
+
+TEST_F(test_Trie, TestTrace) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("dog");
+
+	shared_ptr<trie_node> root = trie.GetRoot();
+	shared_ptr<trie_node> c_node = root->children.at(letter_index('c'));
+	shared_ptr<trie_node> t_node = c_node->children.at(letter_index('a'))->children.at(letter_index('t'));
+	shared_ptr<trie_node> s_node = t_node->children.at(letter_index('s'));
+	shared_ptr<trie_node> d_node = root->children.at(letter_index('d'));
+
+	// Nothing is counted before tracing starts
+	trie.Search("cat");
+	ASSERT_EQ(root->visits.load(), 0);
+
+	trie.StartTrace();
+	trie.Search("cat");
+	trie.Search("cab");
+	trie.SuggestionsForPrefix("ca");
+
+	ASSERT_EQ(root->visits.load(), 3);
+	ASSERT_EQ(c_node->visits.load(), 3);
+	ASSERT_EQ(t_node->visits.load(), 2);
+	ASSERT_EQ(s_node->visits.load(), 1);
+	ASSERT_EQ(d_node->visits.load(), 0);
+
+	// Nothing more is counted once tracing stops, but the counts are kept
+	trie.StopTrace();
+	trie.Search("dog");
+	ASSERT_EQ(root->visits.load(), 3);
+	ASSERT_EQ(d_node->visits.load(), 0);
+
+	// Starting again clears the old counts
+	trie.StartTrace();
+	ASSERT_EQ(root->visits.load(), 0);
+	ASSERT_EQ(c_node->visits.load(), 0);
+
+	// Inserts and removes aren't counted, even though they check whether the word is there
+	trie.Insert("cow");
+	trie.Insert("dog");
+	trie.Remove("cats");
+	trie.Remove("bird");
+	ASSERT_EQ(root->visits.load(), 0);
+	ASSERT_EQ(c_node->visits.load(), 0);
+	ASSERT_EQ(d_node->visits.load(), 0);
+
+	// Neither are range counts, which check whether the upper end of the range is a word
+	ASSERT_EQ(trie.CountRange("a", "cat"), 1);
+	ASSERT_EQ(root->visits.load(), 0);
+	ASSERT_EQ(c_node->visits.load(), 0);
+}
+
+TEST_F(test_Trie, TestTraceGroupedLookups) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("cats");
+	trie.Insert("dog");
+
+	shared_ptr<trie_node> root = trie.GetRoot();
+	shared_ptr<trie_node> c_node = root->children.at(letter_index('c'));
+	shared_ptr<trie_node> t_node = c_node->children.at(letter_index('a'))->children.at(letter_index('t'));
+	shared_ptr<trie_node> s_node = t_node->children.at(letter_index('s'));
+	shared_ptr<trie_node> d_node = root->children.at(letter_index('d'));
+
+	// Grouped lookups count the same nodes as the same lookups made one at a time,
+	// even though they share their walks
+	trie.StartTrace();
+	trie.SearchMany(vector<string> { "cat", "cats", });
+	trie.SuggestionsForPrefixes(vector<string> { "ca", });
+	ASSERT_EQ(root->visits.load(), 3);
+	ASSERT_EQ(c_node->visits.load(), 3);
+	ASSERT_EQ(t_node->visits.load(), 3);
+	ASSERT_EQ(s_node->visits.load(), 2);
+	ASSERT_EQ(d_node->visits.load(), 0);
+}
+
+TEST_F(test_Trie, TestTraceFromSeveralThreads) {
+	Trie trie;
+	trie.Insert("cat");
+	trie.Insert("dog");
+
+	// Lookups on several threads at once are all counted
+	trie.StartTrace();
+	vector<thread> threads;
+
+	for (int i = 0; i < 4; i++) {
+		threads.push_back(thread([&trie]() {
+			for (int j = 0; j < 1000; j++) {
+				trie.Search("cat");
+			}
+		}));
+	}
+
+	for (auto& search_thread : threads) {
+		search_thread.join();
+	}
+
+	trie.StopTrace();
+	ASSERT_EQ(trie.GetRoot()->visits.load(), 4000);
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('c'))->visits.load(), 4000);
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('d'))->visits.load(), 0);
+}
+
+TEST_F(test_Trie, TestRelayoutByTrace) {
+	Trie trie;
+	trie.Insert("apple");
+	trie.Insert("cat");
+	trie.Insert("bark");
+	trie.Insert("applesauce");
+	trie.Insert("zebra");
+
+	vector<string> words = trie.GetAllWords();
+	shared_ptr<trie_node> old_root = trie.GetRoot();
+
+	trie.StartTrace();
+	trie.Search("zebra");
+	trie.Search("zebra");
+	trie.Search("cat");
+	trie.StopTrace();
+
+	// root + "apple" + "sauce" + "bark" + "cat" + "zebra"
+	ASSERT_EQ(trie.RelayoutByTrace(), 1 + 5 + 5 + 4 + 3 + 5);
+
+	// The nodes are new, but the words, counts and visits are the same
+	ASSERT_NE(trie.GetRoot(), old_root);
+	ASSERT_EQ(trie.GetAllWords(), words);
+	ASSERT_EQ(trie.Rank("cat"), 3);
+	ASSERT_EQ(trie.GetRoot()->visits.load(), 3);
+	ASSERT_EQ(trie.GetRoot()->children.at(letter_index('z'))->visits.load(), 2);
+
+	trie.Insert("catch");
+	trie.Remove("zebra");
+	ASSERT_EQ(trie.SuggestionsForPrefix("cat"), (vector<string> { "cat", "catch", }));
+	ASSERT_FALSE(trie.Search("zebra"));
+}
\ No newline at end of file
@@ -0,0 +1,195 @@
+// Checkout TEST_F functions below to learn what is being tested.
+#include <gtest/gtest.h>
+#include "../app/protocol.h"
+#include "../app/request_queue.h"
+
+#include <iostream>
+
+using namespace std;
+
+class test_protocol : public ::testing::Test {
+protected:
+	// This function runs only once before any TEST_F function
+	static void SetUpTestCase(){
+	}
+
+	// This function runs after all TEST_F functions have been executed
+	static void TearDownTestCase(){
+	}
+
+	// this function runs before every TEST_F function
+	void SetUp() override {}
+
+	// this function runs after every TEST_F function
+	void TearDown() override {
+	}
+};
+
+/////////////////////////////////////////
+// Test Helper Functions
+/////////////////////////////////////////
+request make_request(uint8_t op, uint32_t id, const string& key) {
+	request req;
+	req.op = op;
+	req.id = id;
+	req.key = key;
+
+	return req;
+}
+
+/////////////////////////////////////////
+// Tests start here
+
+TEST_F(test_protocol, TestRequestRoundTrip) {
+	string buffer;
+	EncodeRequest(buffer, make_request(OP_SUGGEST, 123456, "cat"));
+	ASSERT_EQ(buffer.length(), REQUEST_HEADER_SIZE + 3);
+
+	request req;
+	ASSERT_EQ(DecodeRequest(buffer, 0, req), buffer.length());
+	ASSERT_EQ(req.op, OP_SUGGEST);
+	ASSERT_EQ(req.id, 123456);
+	ASSERT_EQ(req.key, "cat");
+
+	// Empty keys work too
+	buffer.clear();
+	EncodeRequest(buffer, make_request(OP_SEARCH, 7, ""));
+	ASSERT_EQ(DecodeRequest(buffer, 0, req), REQUEST_HEADER_SIZE);
+	ASSERT_EQ(req.id, 7);
+	ASSERT_EQ(req.key, "");
+}
+
+TEST_F(test_protocol, TestResponseRoundTrip) {
+	string buffer;
+	response res;
+	res.id = 42;
+	res.status = STATUS_NOT_FOUND;
+	res.payload = "cat\ncats\n";
+	EncodeResponse(buffer, res);
+	ASSERT_EQ(buffer.length(), RESPONSE_HEADER_SIZE + res.payload.length());
+
+	response decoded;
+	ASSERT_EQ(DecodeResponse(buffer, 0, decoded), buffer.length());
+	ASSERT_EQ(decoded.id, 42);
+	ASSERT_EQ(decoded.status, STATUS_NOT_FOUND);
+	ASSERT_EQ(decoded.payload, "cat\ncats\n");
+}
+
+TEST_F(test_protocol, TestPartialMessages) {
+	string buffer;
+	EncodeRequest(buffer, make_request(OP_INSERT, 1, "zebra"));
+
+	// Nothing is decoded until the whole request has arrived, whether the header or the key is cut short
+	request req;
+	for (size_t length = 0; length < buffer.length(); length++) {
+		ASSERT_EQ(DecodeRequest(buffer.substr(0, length), 0, req), 0);
+	}
+
+	string response_buffer;
+	response res;
+	res.id = 1;
+	res.status = STATUS_OK;
+	res.payload = "zebra\n";
+	EncodeResponse(response_buffer, res);
+
+	for (size_t length = 0; length < response_buffer.length(); length++) {
+		ASSERT_EQ(DecodeResponse(response_buffer.substr(0, length), 0, res), 0);
+	}
+}
+
+TEST_F(test_protocol, TestPipelinedMessages) {
+	string buffer;
+	EncodeRequest(buffer, make_request(OP_INSERT, 1, "qqqzz"));
+	EncodeRequest(buffer, make_request(OP_SUGGEST, 2, "qqq"));
+	EncodeRequest(buffer, make_request(OP_SEARCH, 3, "qqqzz"));
+
+	// Cut the last request short, as if it were still arriving
+	buffer.erase(buffer.length() - 2);
+
+	vector<request> decoded;
+	request req;
+	size_t offset = 0;
+
+	while (size_t used = DecodeRequest(buffer, offset, req)) {
+		decoded.push_back(req);
+		offset += used;
+	}
+
+	ASSERT_EQ(decoded.size(), 2);
+	ASSERT_EQ(decoded.at(0).id, 1);
+	ASSERT_EQ(decoded.at(0).key, "qqqzz");
+	ASSERT_EQ(decoded.at(1).id, 2);
+	ASSERT_EQ(decoded.at(1).key, "qqq");
+	ASSERT_EQ(offset, 2 * REQUEST_HEADER_SIZE + 8);
+}
+
+TEST_F(test_protocol, TestRequestQueueInsertThenRead) {
+	RequestQueue queue;
+	vector<request> ready;
+
+	// A client pipelines an insert and then reads of the word it inserted
+	queue.Add(make_request(OP_INSERT, 1, "qqqzz"));
+	queue.Add(make_request(OP_SUGGEST, 2, "qqq"));
+	queue.Add(make_request(OP_SEARCH, 3, "qqqzz"));
+
+	// Only the insert can run at first
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 1);
+	ASSERT_EQ(ready.at(0).id, 1);
+
+	// The reads stay held until the insert finishes
+	ready.clear();
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 0);
+
+	queue.Finish(OP_INSERT);
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 2);
+	ASSERT_EQ(ready.at(0).id, 2);
+	ASSERT_EQ(ready.at(1).id, 3);
+	ASSERT_FALSE(queue.Idle());
+
+	queue.Finish(OP_SUGGEST);
+	queue.Finish(OP_SEARCH);
+	ASSERT_TRUE(queue.Idle());
+}
+
+TEST_F(test_protocol, TestRequestQueueReadThenInsert) {
+	RequestQueue queue;
+	vector<request> ready;
+
+	// Reads run together, but an insert waits until the reads before it have finished
+	queue.Add(make_request(OP_SEARCH, 1, "cat"));
+	queue.Add(make_request(OP_SEARCH, 2, "dog"));
+	queue.Add(make_request(OP_INSERT, 3, "cat"));
+	queue.Add(make_request(OP_SEARCH, 4, "cat"));
+
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 2);
+
+	queue.Finish(OP_SEARCH);
+	ready.clear();
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 0);
+
+	queue.Finish(OP_SEARCH);
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 1);
+	ASSERT_EQ(ready.at(0).id, 3);
+
+	queue.Finish(OP_INSERT);
+	ready.clear();
+	queue.Release(ready);
+	ASSERT_EQ(ready.size(), 1);
+	ASSERT_EQ(ready.at(0).id, 4);
+}
+
+TEST_F(test_protocol, TestWriteOps) {
+	// Anything that changes the trie or its trace has to run on its own
+	ASSERT_TRUE(IsWriteOp(OP_INSERT));
+	ASSERT_TRUE(IsWriteOp(OP_TRACE_START));
+	ASSERT_TRUE(IsWriteOp(OP_TRACE_STOP));
+	ASSERT_TRUE(IsWriteOp(OP_RELAYOUT));
+	ASSERT_FALSE(IsWriteOp(OP_SEARCH));
+	ASSERT_FALSE(IsWriteOp(OP_SUGGEST));
+}